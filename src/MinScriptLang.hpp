@@ -91,12 +91,14 @@ namespace AST { struct FunctionDefinition; }
 class Value;
 class Object;
 class Array;
+class StringBuilder;
 class Environment;
+class ValueSpan;
 enum class SystemFunction;
 
-using HostFunction = Value(Environment& env, const PlaceInCode& place, std::vector<Value>&& args);
+using HostFunction = Value(Environment& env, const PlaceInCode& place, ValueSpan args);
     
-enum class ValueType { Null, Number, String, Function, SystemFunction, HostFunction, Object, Array, Type, Count };
+enum class ValueType { Null, Number, String, Function, SystemFunction, HostFunction, Object, Array, StringBuilder, Type, Count };
 class Value
 {
 public:
@@ -108,6 +110,7 @@ public:
     explicit Value(HostFunction func) : m_Type{ValueType::HostFunction}, m_Variant{func} { assert(func); }
     explicit Value(std::shared_ptr<Object> &&obj) : m_Type{ValueType::Object}, m_Variant(obj) { }
     explicit Value(std::shared_ptr<Array> &&arr) : m_Type{ValueType::Array}, m_Variant(arr) { }
+    explicit Value(std::shared_ptr<StringBuilder> &&sb) : m_Type{ValueType::StringBuilder}, m_Variant(sb) { }
     explicit Value(ValueType typeVal) : m_Type{ValueType::Type}, m_Variant(typeVal) { }
 
     ValueType GetType() const { return m_Type; }
@@ -161,6 +164,16 @@ public:
         assert(m_Type == ValueType::Array && std::get<std::shared_ptr<Array>>(m_Variant));
         return std::get<std::shared_ptr<Array>>(m_Variant);
     }
+    StringBuilder* GetStringBuilder() const
+    {
+        assert(m_Type == ValueType::StringBuilder && std::get<std::shared_ptr<StringBuilder>>(m_Variant));
+        return std::get<std::shared_ptr<StringBuilder>>(m_Variant).get();
+    }
+    std::shared_ptr<StringBuilder> GetStringBuilderPtr() const
+    {
+        assert(m_Type == ValueType::StringBuilder && std::get<std::shared_ptr<StringBuilder>>(m_Variant));
+        return std::get<std::shared_ptr<StringBuilder>>(m_Variant);
+    }
     ValueType GetTypeValue() const
     {
         assert(m_Type == ValueType::Type);
@@ -183,6 +196,7 @@ private:
         HostFunction*, // ValueType::HostFunction
         std::shared_ptr<Object>, // ValueType::Object
         std::shared_ptr<Array>, // ValueType::Array
+        std::shared_ptr<StringBuilder>, // ValueType::StringBuilder
         ValueType>; // ValueType::Type
     VariantType m_Variant;
 };
@@ -207,6 +221,30 @@ public:
     std::vector<Value> Items;
 };
 
+// Mutable string buffer with amortized O(1) append, for building long strings in loops.
+class StringBuilder
+{
+public:
+    std::string Str;
+};
+
+// Non-owning view of function call arguments. They are owned by the caller only for the duration of the call,
+// so the function can modify them or move them out.
+class ValueSpan
+{
+public:
+    ValueSpan() { }
+    ValueSpan(Value* data, size_t count) : m_Data{data}, m_Count{count} { }
+    size_t size() const { return m_Count; }
+    bool empty() const { return m_Count == 0; }
+    Value& operator[](size_t index) const { assert(index < m_Count); return m_Data[index]; }
+    Value* begin() const { return m_Data; }
+    Value* end() const { return m_Data + m_Count; }
+private:
+    Value* m_Data = nullptr;
+    size_t m_Count = 0;
+};
+
 #define MINSL_EXECUTION_CHECK(condition, place, errorMessage) \
     do { if(!(condition)) throw ExecutionError((place), (errorMessage)); } while(false)
 #define MINSL_EXECUTION_FAIL(place, errorMessage) \
@@ -276,6 +314,16 @@ public:
     Value Execute(const std::string_view& code);
     const std::string& GetOutput() const;
     std::string_view GetTypeName(ValueType type) const;
+    // Maximum depth of nested script function calls, above which "Stack overflow." error is raised. Default: 10000.
+    // Scripts are executed on a separate native stack reserved for this many calls and committed as it is used,
+    // so the limit doesn't depend on the stack size of the calling thread.
+    void SetMaxCallDepth(size_t maxCallDepth);
+    size_t GetMaxCallDepth() const;
+    // Parsed code is optimized before execution: operators with constant operands are evaluated up front,
+    // unreachable branches and statements are removed. Default: true.
+    // Turning it off is meant for testing that optimized code behaves the same.
+    void SetOptimizationEnabled(bool enabled);
+    bool IsOptimizationEnabled() const;
 private:
     EnvironmentPimpl* pimpl;
 };
@@ -302,8 +350,24 @@ private:
 /////////////////////////////////////////////////////////////////////////////////
 
 #include <map>
+#include <unordered_set>
 #include <algorithm>
 #include <initializer_list>
+#include <exception>
+#include <new>
+
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <Windows.h>
+#else
+    #include <ucontext.h>
+    #include <sys/mman.h>
+#endif
 
 #include <cstdlib>
 #include <cstring>
@@ -327,9 +391,13 @@ namespace MinScriptLang {
 ////////////////////////////////////////////////////////////////////////////////
 // Basic facilities
 
-// I would like it to be higher, but above that, even at 128, it crashes with
-// native "stack overflow" in Debug configuration.
-static const size_t LOCAL_SCOPE_STACK_MAX_SIZE = 100;
+// Each script call nests several levels of native Execute/Evaluate recursion, so scripts are executed on
+// a separate stack sized for the maximum call depth - see ExecutionStack.
+static const size_t DEFAULT_MAX_CALL_DEPTH = 10000;
+// Generous, because Debug configuration uses large native frames.
+static const size_t EXECUTION_STACK_SIZE_PER_CALL = 16 * 1024;
+// Space that must remain free on the execution stack to start another call.
+static const size_t EXECUTION_STACK_SAFETY_MARGIN = 256 * 1024;
 
 static constexpr string_view ERROR_MESSAGE_PARSING_ERROR = "Parsing error.";
 static constexpr string_view ERROR_MESSAGE_INVALID_NUMBER = "Invalid number.";
@@ -353,6 +421,7 @@ static constexpr string_view ERROR_MESSAGE_EXPECTED_NUMBER = "Expected number.";
 static constexpr string_view ERROR_MESSAGE_EXPECTED_STRING = "Expected string.";
 static constexpr string_view ERROR_MESSAGE_EXPECTED_OBJECT = "Expected object.";
 static constexpr string_view ERROR_MESSAGE_EXPECTED_ARRAY = "Expected array.";
+static constexpr string_view ERROR_MESSAGE_EXPECTED_STRING_BUILDER = "Expected StringBuilder.";
 static constexpr string_view ERROR_MESSAGE_EXPECTED_OBJECT_MEMBER = "Expected object member.";
 static constexpr string_view ERROR_MESSAGE_EXPECTED_SINGLE_CHARACTER_STRING = "Expected single character string.";
 static constexpr string_view ERROR_MESSAGE_EXPECTED_SYMBOL                     = "Expected symbol.";
@@ -382,7 +451,7 @@ static constexpr string_view ERROR_MESSAGE_REPEATING_KEY_IN_OBJECT = "Repeating
 static constexpr string_view ERROR_MESSAGE_STACK_OVERFLOW = "Stack overflow.";
 static constexpr string_view ERROR_MESSAGE_BASE_MUST_BE_OBJECT = "Base must be object.";
 
-static constexpr string_view VALUE_TYPE_NAMES[] = { "Null", "Number", "String", "Function", "Function", "Function", "Object", "Array", "Type" };
+static constexpr string_view VALUE_TYPE_NAMES[] = { "Null", "Number", "String", "Function", "Function", "Function", "Object", "Array", "StringBuilder", "Type" };
 static_assert(_countof(VALUE_TYPE_NAMES) == (size_t)ValueType::Count);
 
 enum class Symbol
@@ -498,6 +567,17 @@ std::string Format(const char* format, ...)
     return result;
 }
 
+// Single character always fits in the small string buffer of std::string, so this doesn't allocate memory.
+static inline Value MakeSingleCharacterString(char ch) { return Value{string(1, ch)}; }
+// Changes value to a single character string, reusing its existing string storage if possible.
+static inline void AssignSingleCharacterString(Value& dst, char ch)
+{
+    if(dst.GetType() == ValueType::String)
+        dst.GetString().assign(1, ch);
+    else
+        dst = MakeSingleCharacterString(ch);
+}
+
 static bool NumberToIndex(size_t& outIndex, double number)
 {
     if(!isfinite(number) || number < 0.f)
@@ -527,6 +607,7 @@ bool Value::IsEqual(const Value& rhs) const
     case ValueType::HostFunction:   return std::get<HostFunction*>(m_Variant) == std::get<HostFunction*>(rhs.m_Variant);
     case ValueType::Object:         return std::get<std::shared_ptr<Object>>(m_Variant).get() == std::get<std::shared_ptr<Object>>(rhs.m_Variant).get();
     case ValueType::Array:          return std::get<std::shared_ptr<Array>>(m_Variant).get() == std::get<std::shared_ptr<Array>>(rhs.m_Variant).get();
+    case ValueType::StringBuilder:  return std::get<std::shared_ptr<StringBuilder>>(m_Variant).get() == std::get<std::shared_ptr<StringBuilder>>(rhs.m_Variant).get();
     case ValueType::Type:           return std::get<ValueType>(m_Variant) == std::get<ValueType>(rhs.m_Variant);
     default: assert(0); return false;
     }
@@ -544,6 +625,7 @@ bool Value::IsTrue() const
     case ValueType::HostFunction:   return true;
     case ValueType::Object:         return true;
     case ValueType::Array:          return true;
+    case ValueType::StringBuilder:  return true;
     case ValueType::Type:           return std::get<ValueType>(m_Variant) != ValueType::Null;
     default: assert(0); return false;
     }
@@ -615,19 +697,28 @@ enum class SystemFunction {
     TypeOf, Print, Min, Max,
     String_resize,
     Array_add, Array_insert, Array_remove,
+    StringBuilder_append, StringBuilder_toString,
     Count
 };
 static constexpr string_view SYSTEM_FUNCTION_NAMES[] = {
     "typeOf", "print", "min", "max",
     "resize",
     "add", "insert", "remove",
+    "append", "toString",
 };
 static_assert(_countof(SYSTEM_FUNCTION_NAMES) == (size_t)SystemFunction::Count);
 
 struct ObjectMemberLValue
 {
     Object* Obj;
-    string Key;
+    const string* KeyRef = nullptr; // Key borrowed from a place that outlives the l-value, like identifier name in AST. Null if KeyStorage is used.
+    string KeyStorage; // Key computed at runtime, e.g. by indexing operator.
+    Value* Slot = nullptr; // Existing value of the member if it was already found, to save another lookup. Optional.
+
+    ObjectMemberLValue(Object* obj, const string& key, Value* slot = nullptr) : Obj{obj}, KeyRef{&key}, Slot{slot} { }
+    ObjectMemberLValue(Object* obj, string&& key) : Obj{obj}, KeyStorage{std::move(key)} { }
+    const string& GetKey() const { return KeyRef ? *KeyRef : KeyStorage; }
+    Value* TryGetValue() const { return Slot ? Slot : Obj->TryGetValue(GetKey()); } // Returns null if doesn't exist.
 };
 struct StringCharacterLValue
 {
@@ -660,7 +751,8 @@ namespace AST
 struct ThisType : public std::variant<
     std::monostate,
     shared_ptr<Object>,
-    shared_ptr<Array>>
+    shared_ptr<Array>,
+    shared_ptr<StringBuilder>>
 {
     bool IsEmpty() const { return std::get_if<std::monostate>(this) != nullptr; }
     Object* GetObject_() const
@@ -673,43 +765,135 @@ struct ThisType : public std::variant<
         const shared_ptr<Array>* arrayPtr = std::get_if<shared_ptr<Array>>(this);
         return arrayPtr ? arrayPtr->get() : nullptr;
     }
+    StringBuilder* GetStringBuilder() const
+    {
+        const shared_ptr<StringBuilder>* sbPtr = std::get_if<shared_ptr<StringBuilder>>(this);
+        return sbPtr ? sbPtr->get() : nullptr;
+    }
     void Clear() { *this = ThisType{}; }
 };
 
+// Stack of values for function call arguments, so calls don't allocate memory for them.
+// Made of chunks, so values already pushed never move when it grows.
+class ValueStack
+{
+public:
+    Value* Push(size_t count); // Returns count consecutive null values.
+    void Pop(Value* values, size_t count); // Must be called in reverse order of Push.
+
+private:
+    static constexpr size_t CHUNK_SIZE = 256;
+    struct Chunk
+    {
+        unique_ptr<Value[]> Values;
+        size_t Capacity;
+        size_t Size;
+    };
+    vector<Chunk> m_Chunks;
+    size_t m_CurrChunkIndex = 0;
+};
+
+// Thrown by a call in tail position instead of making the call. Arguments are passed in ExecuteContext::TailCallArguments.
+// Caught by CallOperator of the function being returned from, which reuses its frame for the new call.
+struct TailCallException
+{
+    const PlaceInCode Place;
+    const FunctionDefinition* Function;
+    ThisType This;
+};
+
 struct ExecuteContext
 {
 public:
     EnvironmentPimpl& Env;
     Object& GlobalScope;
+    vector<Value> TailCallArguments; // See TailCallException.
 
+    // Local scope objects are reused between calls.
     struct LocalScopePush
     {
-        LocalScopePush(ExecuteContext& ctx, Object* localScope, ThisType&& thisObj, const PlaceInCode& place) :
+        LocalScopePush(ExecuteContext& ctx, ThisType&& thisObj, const PlaceInCode& place) :
             m_Ctx{ctx}
         {
-            if(ctx.LocalScopes.size() == LOCAL_SCOPE_STACK_MAX_SIZE)
+            const size_t depth = ctx.LocalScopes.size();
+            const char stackMarker = 0;
+            if(depth == ctx.MaxCallDepth || (uintptr_t)&stackMarker < ctx.StackLimit)
                 throw ExecutionError{place, ERROR_MESSAGE_STACK_OVERFLOW};
-            ctx.LocalScopes.push_back(localScope);
+            if(depth == ctx.LocalScopeStorage.size())
+                ctx.LocalScopeStorage.push_back(std::make_unique<Object>());
+            ctx.LocalScopes.push_back(ctx.LocalScopeStorage[depth].get());
             ctx.Thises.push_back(std::move(thisObj));
         }
         ~LocalScopePush()
         {
             m_Ctx.Thises.pop_back();
+            m_Ctx.ReleaseLocalScope(*m_Ctx.LocalScopes.back());
             m_Ctx.LocalScopes.pop_back();
         }
     private:
         ExecuteContext& m_Ctx;
     };
 
-    ExecuteContext(EnvironmentPimpl& env, Object& globalScope) : Env{env}, GlobalScope{globalScope} { }
+    // Window of consecutive values on the value stack, valid until destruction.
+    struct ArgumentWindow
+    {
+        ArgumentWindow(ExecuteContext& ctx, size_t count) : m_Ctx{ctx}, m_Span{ctx.ArgumentStack.Push(count), count} { }
+        ~ArgumentWindow() { m_Ctx.ArgumentStack.Pop(m_Span.begin(), m_Span.size()); }
+        ValueSpan GetSpan() const { return m_Span; }
+    private:
+        ExecuteContext& m_Ctx;
+        const ValueSpan m_Span;
+    };
+
+    // stackLimit: Lowest address of native stack that a new call can start below, or 0 if unknown.
+    ExecuteContext(EnvironmentPimpl& env, Object& globalScope, size_t maxCallDepth, uintptr_t stackLimit) :
+        Env{env}, GlobalScope{globalScope}, MaxCallDepth{maxCallDepth}, StackLimit{stackLimit} { }
     bool IsLocal() const { return !LocalScopes.empty(); }
     Object* GetCurrentLocalScope() { assert(IsLocal()); return LocalScopes.back(); }
     const ThisType& GetThis() { assert(IsLocal()); return Thises.back(); }
     Object& GetInnermostScope() const { return IsLocal() ? *LocalScopes.back() : GlobalScope; }
+    // Creates new variable in a local scope, reusing a map node released by previous calls if available.
+    void CreateLocalVariable(Object& localScope, const string& name, Value&& val);
+    // Clears current local scope and replaces its 'this', for a tail call reusing current frame.
+    void ResetCurrentLocalScope(ThisType&& thisObj)
+    {
+        assert(IsLocal());
+        ReleaseLocalScope(*LocalScopes.back());
+        Thises.back() = std::move(thisObj);
+    }
 
 private:
+    const size_t MaxCallDepth;
+    const uintptr_t StackLimit;
     vector<Object*> LocalScopes;
     vector<ThisType> Thises;
+    vector<unique_ptr<Object>> LocalScopeStorage; // Indexed by depth of LocalScopes.
+    vector<Object::MapType::node_type> FreeLocalVariableNodes;
+    ValueStack ArgumentStack;
+
+    void ReleaseLocalScope(Object& localScope);
+
+public:
+    // Values of AST::CachedExpression nodes, indexed by slot. Valid only inside AST::CacheScope that owns the slot.
+    struct CachedValue
+    {
+        Value Val;
+        bool Valid = false;
+    };
+    vector<CachedValue> CachedValues;
+};
+
+class Optimizer;
+
+// What executing a statement or evaluating an expression can read and modify. Variables are identified by name only.
+struct Effects
+{
+    std::unordered_set<string> ReadVariables;
+    std::unordered_set<string> WrittenVariables;
+    bool ReadsMembers = false; // Of any object, array or string.
+    bool WritesMembers = false;
+    bool HasCalls = false; // Called function can read and modify anything.
+    bool CreatesObjects = false;
 };
 
 struct Statement
@@ -719,6 +903,10 @@ struct Statement
     const PlaceInCode& GetPlace() const { return m_Place; }
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const = 0;
     virtual void Execute(ExecuteContext& ctx) const = 0;
+    // Optimizes child nodes in place. Returns statement that should replace this one, or null to keep it.
+    virtual unique_ptr<Statement> Optimize(Optimizer& optimizer) { return {}; }
+    // Adds effects of this node and its children. Nodes that don't implement it are assumed to do anything.
+    virtual void CollectEffects(Effects& effects) const { effects.HasCalls = true; }
 protected:
     void Assign(const LValue& lhs, Value&& rhs) const;
 private:
@@ -730,6 +918,7 @@ struct EmptyStatement : public Statement
     explicit EmptyStatement(const PlaceInCode& place) : Statement{place} { }
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
     virtual void Execute(ExecuteContext& ctx) const { }
+    virtual void CollectEffects(Effects& effects) const { }
 };
 
 struct Expression;
@@ -741,6 +930,8 @@ struct Condition : public Statement
     explicit Condition(const PlaceInCode& place) : Statement{place} { }
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
     virtual void Execute(ExecuteContext& ctx) const;
+    virtual unique_ptr<Statement> Optimize(Optimizer& optimizer);
+    virtual void CollectEffects(Effects& effects) const;
 };
 
 const enum WhileLoopType { While, DoWhile };
@@ -753,6 +944,8 @@ struct WhileLoop : public Statement
     explicit WhileLoop(const PlaceInCode& place, WhileLoopType type) : Statement{place}, Type{type} { }
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
     virtual void Execute(ExecuteContext& ctx) const;
+    virtual unique_ptr<Statement> Optimize(Optimizer& optimizer);
+    virtual void CollectEffects(Effects& effects) const;
 };
 
 struct ForLoop : public Statement
@@ -764,6 +957,10 @@ struct ForLoop : public Statement
     explicit ForLoop(const PlaceInCode& place) : Statement{place} { }
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
     virtual void Execute(ExecuteContext& ctx) const;
+    virtual unique_ptr<Statement> Optimize(Optimizer& optimizer);
+    virtual void CollectEffects(Effects& effects) const;
+    // Executes the loop without InitExpression.
+    void ExecuteIterations(ExecuteContext& ctx) const;
 };
 
 struct RangeBasedForLoop : public Statement
@@ -775,6 +972,8 @@ struct RangeBasedForLoop : public Statement
     explicit RangeBasedForLoop(const PlaceInCode& place) : Statement{place} { }
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
     virtual void Execute(ExecuteContext& ctx) const;
+    virtual unique_ptr<Statement> Optimize(Optimizer& optimizer);
+    virtual void CollectEffects(Effects& effects) const;
 };
 
 enum class LoopBreakType { Break, Continue, Count };
@@ -784,6 +983,7 @@ struct LoopBreakStatement : public Statement
     explicit LoopBreakStatement(const PlaceInCode& place, LoopBreakType type) : Statement{place}, Type{type} { }
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
     virtual void Execute(ExecuteContext& ctx) const;
+    virtual void CollectEffects(Effects& effects) const { }
 };
 
 struct ReturnStatement : public Statement
@@ -792,6 +992,8 @@ struct ReturnStatement : public Statement
     explicit ReturnStatement(const PlaceInCode& place) : Statement{place} { }
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
     virtual void Execute(ExecuteContext& ctx) const;
+    virtual unique_ptr<Statement> Optimize(Optimizer& optimizer);
+    virtual void CollectEffects(Effects& effects) const;
 };
 
 struct Block : public Statement
@@ -800,6 +1002,9 @@ struct Block : public Statement
     vector<unique_ptr<Statement>> Statements;
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
     virtual void Execute(ExecuteContext& ctx) const;
+    // Never replaces itself, nested blocks are merged into the parent block instead.
+    virtual unique_ptr<Statement> Optimize(Optimizer& optimizer);
+    virtual void CollectEffects(Effects& effects) const;
 };
 
 struct ConstantValue;
@@ -812,6 +1017,8 @@ struct SwitchStatement : public Statement
     explicit SwitchStatement(const PlaceInCode& place) : Statement{place} { }
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
     virtual void Execute(ExecuteContext& ctx) const;
+    virtual unique_ptr<Statement> Optimize(Optimizer& optimizer);
+    virtual void CollectEffects(Effects& effects) const;
 };
 
 struct ThrowStatement : public Statement
@@ -820,6 +1027,8 @@ struct ThrowStatement : public Statement
     explicit ThrowStatement(const PlaceInCode& place) : Statement{place} { }
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
     virtual void Execute(ExecuteContext& ctx) const;
+    virtual unique_ptr<Statement> Optimize(Optimizer& optimizer);
+    virtual void CollectEffects(Effects& effects) const;
 };
 
 struct TryStatement : public Statement
@@ -831,6 +1040,8 @@ struct TryStatement : public Statement
     explicit TryStatement(const PlaceInCode& place) : Statement{place} { }
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
     virtual void Execute(ExecuteContext& ctx) const;
+    virtual unique_ptr<Statement> Optimize(Optimizer& optimizer);
+    virtual void CollectEffects(Effects& effects) const;
 };
 
 struct Script : Block
@@ -839,12 +1050,59 @@ struct Script : Block
     virtual void Execute(ExecuteContext& ctx) const;
 };
 
+// Created by Optimizer. Values of CachedExpression nodes in Slots are reused until Inner finishes executing.
+struct CacheScope : public Statement
+{
+    unique_ptr<Statement> Inner;
+    vector<size_t> Slots; // Ascending.
+    CacheScope(unique_ptr<Statement>&& inner, vector<size_t>&& slots) :
+        Statement{inner->GetPlace()}, Inner{std::move(inner)}, Slots{std::move(slots)} { }
+    virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
+    virtual void Execute(ExecuteContext& ctx) const;
+    virtual void CollectEffects(Effects& effects) const { Inner->CollectEffects(effects); }
+};
+
+// Returns owned value out of the reference returned by Expression::EvaluateRef, moving it if it is the temporary.
+static inline Value TakeEvaluatedValue(const Value& ref, Value& temp)
+{
+    if(&ref == &temp)
+        return std::move(temp);
+    return ref;
+}
+
 struct Expression : Statement
 {
     explicit Expression(const PlaceInCode& place) : Statement{place} { }
     virtual Value Evaluate(ExecuteContext& ctx, ThisType* outThis) const { return GetLValue(ctx).GetValue(GetPlace()); }
+    // Like Evaluate, but returns reference to the value where it already lives (variable, object member, array item, constant)
+    // instead of copying it. If the value had to be created, it is stored in outTemp and reference to outTemp is returned.
+    // Borrowed reference is valid only until something with side effects is executed.
+    virtual const Value& EvaluateRef(ExecuteContext& ctx, Value& outTemp, ThisType* outThis) const { return outTemp = Evaluate(ctx, outThis); }
     virtual LValue GetLValue(ExecuteContext& ctx) const { MINSL_EXECUTION_CHECK( false, GetPlace(), ERROR_MESSAGE_EXPECTED_LVALUE ); }
     virtual void Execute(ExecuteContext& ctx) const { Evaluate(ctx, nullptr); }
+    // Returns false only if evaluation is guaranteed not to modify any variable, object, array or string.
+    virtual bool HasSideEffects() const { return true; }
+    bool EvaluateCondition(ExecuteContext& ctx) const { Value temp; return EvaluateRef(ctx, temp, nullptr).IsTrue(); }
+    // Returns the value if this expression is a constant, otherwise null.
+    virtual const Value* GetConstantValue() const { return nullptr; }
+    // Appends string that identifies this expression by its structure. Expressions with equal keys evaluate to the same value
+    // as long as variables and members they read don't change. Returns false if the expression can have side effects.
+    virtual bool AppendKey(string& out) const { return false; }
+    virtual unique_ptr<Statement> Optimize(Optimizer& optimizer);
+    // Optimizes operands in place.
+    virtual void OptimizeOperands(Optimizer& optimizer) { }
+    // Called after OptimizeOperands. Returns equivalent expression that should replace this one, or null to keep it.
+    // valueOnly: Only the value of this expression is used, not its l-value or 'this' it provides for a function call.
+    virtual unique_ptr<Expression> Simplify(Optimizer& optimizer, bool valueOnly) { return {}; }
+
+protected:
+    // For expressions that implement EvaluateRef.
+    Value EvaluateViaRef(ExecuteContext& ctx, ThisType* outThis) const
+    {
+        Value temp;
+        const Value& result = EvaluateRef(ctx, temp, outThis);
+        return TakeEvaluatedValue(result, temp);
+    }
 };
 
 struct ConstantExpression : Expression
@@ -862,6 +1120,11 @@ struct ConstantValue : ConstantExpression
     }
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
     virtual Value Evaluate(ExecuteContext& ctx, ThisType* outThis) const { return Value{Val}; }
+    virtual const Value& EvaluateRef(ExecuteContext& ctx, Value& outTemp, ThisType* outThis) const { return Val; }
+    virtual bool HasSideEffects() const { return false; }
+    virtual const Value* GetConstantValue() const { return &Val; }
+    virtual bool AppendKey(string& out) const;
+    virtual void CollectEffects(Effects& effects) const { }
 };
 
 enum class IdentifierScope { None, Local, Global, Count };
@@ -871,8 +1134,12 @@ struct Identifier : ConstantExpression
     string S;
     Identifier(const PlaceInCode& place, IdentifierScope scope, string&& s) : ConstantExpression{place}, Scope(scope), S(std::move(s)) { }
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
-    virtual Value Evaluate(ExecuteContext& ctx, ThisType* outThis) const;
+    virtual Value Evaluate(ExecuteContext& ctx, ThisType* outThis) const { return EvaluateViaRef(ctx, outThis); }
+    virtual const Value& EvaluateRef(ExecuteContext& ctx, Value& outTemp, ThisType* outThis) const;
     virtual LValue GetLValue(ExecuteContext& ctx) const;
+    virtual bool HasSideEffects() const { return false; }
+    virtual bool AppendKey(string& out) const;
+    virtual void CollectEffects(Effects& effects) const { effects.ReadVariables.insert(S); }
 };
 
 struct ThisExpression : ConstantExpression
@@ -880,6 +1147,9 @@ struct ThisExpression : ConstantExpression
     ThisExpression(const PlaceInCode& place) : ConstantExpression{place} { }
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
     virtual Value Evaluate(ExecuteContext& ctx, ThisType* outThis) const;
+    virtual bool HasSideEffects() const { return false; }
+    virtual bool AppendKey(string& out) const { out += "this"; return true; }
+    virtual void CollectEffects(Effects& effects) const { }
 };
 
 struct Operator : Expression
@@ -900,9 +1170,15 @@ struct UnaryOperator : Operator
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
     virtual Value Evaluate(ExecuteContext& ctx, ThisType* outThis) const;
     virtual LValue GetLValue(ExecuteContext& ctx) const;
+    virtual bool HasSideEffects() const;
+    virtual void OptimizeOperands(Optimizer& optimizer);
+    virtual unique_ptr<Expression> Simplify(Optimizer& optimizer, bool valueOnly);
+    virtual bool AppendKey(string& out) const;
+    virtual void CollectEffects(Effects& effects) const;
 
 private:
-    Value BitwiseNot(Value&& operand) const;
+    bool RequiresLValue() const;
+    Value BitwiseNot(const Value& operand) const;
 };
 
 struct MemberAccessOperator : Operator
@@ -911,8 +1187,14 @@ struct MemberAccessOperator : Operator
     string MemberName;
     MemberAccessOperator(const PlaceInCode& place) : Operator{place} { }
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
-    virtual Value Evaluate(ExecuteContext& ctx, ThisType* outThis) const;
+    virtual Value Evaluate(ExecuteContext& ctx, ThisType* outThis) const { return EvaluateViaRef(ctx, outThis); }
+    virtual const Value& EvaluateRef(ExecuteContext& ctx, Value& outTemp, ThisType* outThis) const;
     virtual LValue GetLValue(ExecuteContext& ctx) const;
+    virtual bool HasSideEffects() const { return Operand->HasSideEffects(); }
+    virtual void OptimizeOperands(Optimizer& optimizer);
+    virtual unique_ptr<Expression> Simplify(Optimizer& optimizer, bool valueOnly);
+    virtual bool AppendKey(string& out) const;
+    virtual void CollectEffects(Effects& effects) const;
 };
 
 enum class BinaryOperatorType
@@ -931,7 +1213,14 @@ struct BinaryOperator : Operator
     BinaryOperator(const PlaceInCode& place, BinaryOperatorType type) : Operator{place}, Type(type) { }
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
     virtual Value Evaluate(ExecuteContext& ctx, ThisType* outThis) const;
+    virtual const Value& EvaluateRef(ExecuteContext& ctx, Value& outTemp, ThisType* outThis) const;
     virtual LValue GetLValue(ExecuteContext& ctx) const;
+    virtual bool HasSideEffects() const;
+    virtual void OptimizeOperands(Optimizer& optimizer);
+    virtual unique_ptr<Expression> Simplify(Optimizer& optimizer, bool valueOnly);
+    virtual bool AppendKey(string& out) const;
+    virtual void CollectEffects(Effects& effects) const;
+    bool IsAssignment() const;
 
 private:
     Value ShiftLeft(const Value& lhs, const Value& rhs) const;
@@ -944,15 +1233,27 @@ struct TernaryOperator : Operator
     unique_ptr<Expression> Operands[3];
     explicit TernaryOperator(const PlaceInCode& place) : Operator{place} { }
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
-    virtual Value Evaluate(ExecuteContext& ctx, ThisType* outThis) const;
+    virtual Value Evaluate(ExecuteContext& ctx, ThisType* outThis) const { return EvaluateViaRef(ctx, outThis); }
+    virtual const Value& EvaluateRef(ExecuteContext& ctx, Value& outTemp, ThisType* outThis) const;
+    virtual bool HasSideEffects() const;
+    virtual void OptimizeOperands(Optimizer& optimizer);
+    virtual unique_ptr<Expression> Simplify(Optimizer& optimizer, bool valueOnly);
+    virtual bool AppendKey(string& out) const;
+    virtual void CollectEffects(Effects& effects) const;
 };
 
 struct CallOperator : Operator
 {
     vector<unique_ptr<Expression>> Operands;
+    bool IsTailCall = false; // Set by parser for 'return f(...);' in a function, outside of try statement.
     CallOperator(const PlaceInCode& place) : Operator{place} { }
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
     virtual Value Evaluate(ExecuteContext& ctx, ThisType* outThis) const;
+    virtual void OptimizeOperands(Optimizer& optimizer);
+    virtual void CollectEffects(Effects& effects) const;
+
+private:
+    Value CallFunction(ExecuteContext& ctx, const FunctionDefinition* funcDef, ThisType&& th, ValueSpan arguments) const;
 };
 
 struct FunctionDefinition : public Expression
@@ -962,6 +1263,10 @@ struct FunctionDefinition : public Expression
     FunctionDefinition(const PlaceInCode& place) : Expression{place}, Body{place} { }
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
     virtual Value Evaluate(ExecuteContext& ctx, ThisType* outThis) const { return Value{this}; }
+    virtual bool HasSideEffects() const { return false; }
+    virtual void OptimizeOperands(Optimizer& optimizer);
+    // Body is not executed by evaluating the definition.
+    virtual void CollectEffects(Effects& effects) const { }
     bool AreParameterNamesUnique() const;
 };
 
@@ -973,6 +1278,8 @@ struct ObjectExpression : public Expression
     ObjectExpression(const PlaceInCode& place) : Expression{place} { }
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
     virtual Value Evaluate(ExecuteContext& ctx, ThisType* outThis) const;
+    virtual void OptimizeOperands(Optimizer& optimizer);
+    virtual void CollectEffects(Effects& effects) const;
 };
 
 struct ArrayExpression : public Expression
@@ -981,6 +1288,95 @@ struct ArrayExpression : public Expression
     ArrayExpression(const PlaceInCode& place) : Expression{ place } { }
     virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
     virtual Value Evaluate(ExecuteContext& ctx, ThisType* outThis) const;
+    virtual void OptimizeOperands(Optimizer& optimizer);
+    virtual void CollectEffects(Effects& effects) const;
+};
+
+// Created by Optimizer. Evaluates Inner on first use and then returns the same value until enclosing CacheScope finishes.
+struct CachedExpression : public Expression
+{
+    unique_ptr<Expression> Inner; // Without side effects.
+    size_t Slot;
+    CachedExpression(unique_ptr<Expression>&& inner, size_t slot) :
+        Expression{inner->GetPlace()}, Inner{std::move(inner)}, Slot{slot} { }
+    virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
+    virtual Value Evaluate(ExecuteContext& ctx, ThisType* outThis) const { return EvaluateViaRef(ctx, outThis); }
+    virtual const Value& EvaluateRef(ExecuteContext& ctx, Value& outTemp, ThisType* outThis) const;
+    virtual bool HasSideEffects() const { return false; }
+    virtual void CollectEffects(Effects& effects) const { Inner->CollectEffects(effects); }
+};
+
+// Created by Optimizer from a loop like: for(i = 0; i < n; ++i). Compares and increments the counter directly
+// in its variable. Falls back to executing Loop as usual if the counter or the bound turns out not to be a number.
+struct CountingForLoop : public Statement
+{
+    unique_ptr<ForLoop> Loop;
+    const Identifier* Counter; // Left operand of Loop->ConditionExpression.
+    const Expression* Bound; // Right operand of Loop->ConditionExpression, without side effects.
+    BinaryOperatorType Comparison; // Less, Greater, LessEqual or GreaterEqual.
+    double Step; // Added to the counter by Loop->IterationExpression.
+    bool BoundIsInvariant = false; // Evaluated once before the first iteration.
+    bool BodyHasCalls = false; // Called functions can modify a global counter.
+    CountingForLoop(unique_ptr<ForLoop>&& loop, const Identifier* counter, BinaryOperatorType comparison, double step) :
+        Statement{loop->GetPlace()}, Loop{std::move(loop)}, Counter{counter},
+        Bound{static_cast<const BinaryOperator*>(Loop->ConditionExpression.get())->Operands[1].get()},
+        Comparison{comparison}, Step{step} { }
+    virtual void DebugPrint(uint32_t indentLevel, const string_view& prefix) const;
+    virtual void Execute(ExecuteContext& ctx) const;
+    virtual void CollectEffects(Effects& effects) const { Loop->CollectEffects(effects); }
+
+private:
+    // Returns the counter variable if it is a number that only this loop can modify, otherwise null.
+    Value* FindCounter(ExecuteContext& ctx) const;
+    // Returns false if the bound is not a number.
+    bool EvaluateBound(ExecuteContext& ctx, double& outBound) const;
+    bool Compare(double counter, double bound) const;
+};
+
+// Transforms parsed tree into equivalent one that executes faster: evaluates operators with constant operands,
+// removes branches and statements that can never execute, and caches values of expressions that don't need
+// to be evaluated again - invariant in a loop or repeated within a statement.
+class Optimizer
+{
+public:
+    explicit Optimizer(EnvironmentPimpl& env) : m_Context{env, m_ScratchScope, 0, 0} { }
+    void Optimize(unique_ptr<Statement>& stmt);
+    // valueOnly: See Expression::Simplify.
+    void Optimize(unique_ptr<Expression>& expr, bool valueOnly = true);
+    void OptimizeFunctionBody(Block& body);
+    // For expression with constant operands. Returns constant with its value, or null if evaluation fails
+    // (the error is left to be reported during execution) or the result is not Null, Number or String.
+    unique_ptr<Expression> TryFold(const Expression& expr);
+
+private:
+    // Loop that doesn't call any functions, so expressions that don't depend on what it modifies can be cached.
+    struct LoopCache
+    {
+        Effects LoopEffects;
+        vector<size_t> Slots;
+    };
+    // Repeated expressions in a statement. Filled in two passes: first counts keys, second creates cached expressions.
+    struct CommonSubexpressions
+    {
+        bool Counting = true;
+        std::unordered_map<string, size_t> Counts;
+        std::unordered_map<string, size_t> Slots;
+    };
+
+    Object m_ScratchScope; // Operators with constant operands never access variables.
+    ExecuteContext m_Context;
+    bool m_InFunction = false;
+    vector<LoopCache> m_Loops; // Enclosing loops within current function, outermost first.
+    CommonSubexpressions* m_CommonSubexpressions = nullptr; // Not null while looking for them.
+    size_t m_NextCacheSlot = 0;
+
+    void OptimizeLoop(unique_ptr<Statement>& loop);
+    // Replaces ForLoop with CountingForLoop if it has the right form.
+    void TrySpecializeCountingLoop(unique_ptr<Statement>& loop, const Effects& loopEffects);
+    void EliminateCommonSubexpressions(unique_ptr<Statement>& stmt);
+    // Returns true if expression was processed and its operands shouldn't be optimized again.
+    bool TryCache(unique_ptr<Expression>& expr);
+    bool IsInvariant(const Effects& exprEffects, const Effects& loopEffects) const;
 };
 
 } // namespace AST
@@ -990,6 +1386,53 @@ static inline void CheckNumberOperand(const AST::Expression* operand, const Valu
     MINSL_EXECUTION_CHECK( value.GetType() == ValueType::Number, operand->GetPlace(), ERROR_MESSAGE_EXPECTED_NUMBER );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// class ExecutionStack definition
+
+// Native stack allocated from the heap, on which a function can run on the current thread.
+// Uses fibers on Windows and ucontext on other platforms. Memory is reserved up front and committed by the OS
+// as it is used.
+class ExecutionStack
+{
+public:
+    explicit ExecutionStack(size_t size);
+    ~ExecutionStack();
+    size_t GetSize() const { return m_Size; }
+    bool IsRunning() const { return m_Running; }
+    // Valid while running. Lowest address that still leaves EXECUTION_STACK_SAFETY_MARGIN free.
+    uintptr_t GetLimit() const { return m_Limit; }
+    // Calls func(userData) on this stack and waits for it to return. Exception thrown by it is rethrown to the caller.
+    void Run(void (*func)(void*), void* userData);
+
+private:
+    struct RunData
+    {
+        ExecutionStack* Stack;
+        void (*Func)(void*);
+        void* UserData;
+        std::exception_ptr Exception;
+#ifdef _WIN32
+        void* CallerFiber;
+#else
+        ucontext_t CallerContext;
+#endif
+    };
+
+    const size_t m_Size;
+    bool m_Running = false;
+    uintptr_t m_Limit = 0;
+#ifndef _WIN32
+    void* m_Memory = nullptr;
+#endif
+
+    static void RunOnStack(RunData& data);
+#ifdef _WIN32
+    static void WINAPI FiberEntry(void* param);
+#else
+    static void ContextEntry(unsigned int dataPtrHi, unsigned int dataPtrLo);
+#endif
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // class Parser definition
 
@@ -1003,6 +1446,9 @@ private:
     Tokenizer& m_Tokenizer;
     vector<Token> m_Tokens;
     size_t m_TokenIndex = 0;
+    // For detection of tail calls.
+    bool m_InFunction = false;
+    uint32_t m_TryDepth = 0;
 
     void ParseBlock(AST::Block& outBlock);
     bool TryParseSwitchItem(AST::SwitchStatement& switchStatement);
@@ -1050,11 +1496,26 @@ public:
     const string& GetOutput() const { return m_Output; }
     string_view GetTypeName(ValueType type) const;
     void Print(const string_view& s) { m_Output.append(s); }
+    size_t GetMaxCallDepth() const { return m_MaxCallDepth; }
+    void SetMaxCallDepth(size_t maxCallDepth) { m_MaxCallDepth = maxCallDepth; }
+    bool IsOptimizationEnabled() const { return m_OptimizationEnabled; }
+    void SetOptimizationEnabled(bool enabled) { m_OptimizationEnabled = enabled; }
 
 private:
     Environment& m_Owner;
     Object& m_GlobalScope;
     string m_Output;
+    size_t m_MaxCallDepth = DEFAULT_MAX_CALL_DEPTH;
+    bool m_OptimizationEnabled = true;
+    unique_ptr<ExecutionStack> m_ExecutionStack; // Created on first use.
+
+    struct ExecuteScriptData
+    {
+        EnvironmentPimpl* Env;
+        const AST::Script* Script;
+        Value Result;
+    };
+    static void ExecuteScript(void* data); // data is ExecuteScriptData.
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1409,7 +1870,7 @@ Value* LValue::GetValueRef(const PlaceInCode& place) const
 {
     if(const ObjectMemberLValue* objMemberLval = std::get_if<ObjectMemberLValue>(this))
     {
-        if(Value* val = objMemberLval->Obj->TryGetValue(objMemberLval->Key))
+        if(Value* val = objMemberLval->TryGetValue())
             return val;
         MINSL_EXECUTION_FAIL(place, ERROR_MESSAGE_OBJECT_MEMBER_DOESNT_EXIST);
     }
@@ -1425,15 +1886,14 @@ Value LValue::GetValue(const PlaceInCode& place) const
 {
     if(const ObjectMemberLValue* objMemberLval = std::get_if<ObjectMemberLValue>(this))
     {
-        if(const Value* val = objMemberLval->Obj->TryGetValue(objMemberLval->Key))
+        if(const Value* val = objMemberLval->TryGetValue())
             return *val;
         MINSL_EXECUTION_FAIL(place, ERROR_MESSAGE_OBJECT_MEMBER_DOESNT_EXIST);
     }
     if(const StringCharacterLValue* strCharLval = std::get_if<StringCharacterLValue>(this))
     {
         MINSL_EXECUTION_CHECK(strCharLval->Index < strCharLval->Str->length(), place, ERROR_MESSAGE_INDEX_OUT_OF_BOUNDS);
-        const char ch = (*strCharLval->Str)[strCharLval->Index];
-        return Value{string{&ch, &ch + 1}};
+        return MakeSingleCharacterString((*strCharLval->Str)[strCharLval->Index]);
     }
     if(const ArrayItemLValue* arrItemLval = std::get_if<ArrayItemLValue>(this))
     {
@@ -1473,58 +1933,73 @@ static shared_ptr<Object> ConvertExecutionErrorToObject(const ExecutionError& er
     obj->GetOrCreateValue("message") = Value{string{err.GetMessage_()}};
     return obj;
 }
-static Value BuiltInTypeCtor_Null(AST::ExecuteContext& ctx, const PlaceInCode& place, std::vector<Value>&& args)
+static Value BuiltInTypeCtor_Null(AST::ExecuteContext& ctx, const PlaceInCode& place, ValueSpan args)
 {
     MINSL_EXECUTION_CHECK(args.empty() || args.size() == 1 && args[0].GetType() == ValueType::Null, place, "Null can be constructed only from no arguments or from another null value.");
     return {};
 }
-static Value BuiltInTypeCtor_Number(AST::ExecuteContext& ctx, const PlaceInCode& place, std::vector<Value>&& args)
+static Value BuiltInTypeCtor_Number(AST::ExecuteContext& ctx, const PlaceInCode& place, ValueSpan args)
 {
     Environment& env = ctx.Env.GetOwner();
     MINSL_LOAD_ARGS_1_NUMBER("Number", val);
     return Value{val};
 }
-static Value BuiltInTypeCtor_String(AST::ExecuteContext& ctx, const PlaceInCode& place, std::vector<Value>&& args)
+static Value BuiltInTypeCtor_String(AST::ExecuteContext& ctx, const PlaceInCode& place, ValueSpan args)
 {
     if(args.empty())
         return Value{string{}};
+    if(args.size() == 1 && args[0].GetType() == ValueType::StringBuilder)
+        return Value{string{args[0].GetStringBuilder()->Str}};
     Environment& env = ctx.Env.GetOwner();
     MINSL_LOAD_ARGS_1_STRING("String", str);
     return Value{std::move(str)};
 }
-static Value BuiltInTypeCtor_Object(AST::ExecuteContext& ctx, const PlaceInCode& place, std::vector<Value>&& args)
+static Value BuiltInTypeCtor_Object(AST::ExecuteContext& ctx, const PlaceInCode& place, ValueSpan args)
 {
     if(args.empty())
         return Value{std::make_shared<Object>()};
     MINSL_EXECUTION_CHECK(args.size() == 1 && args[0].GetType() == ValueType::Object, place, "Object can be constructed only from no arguments or from another object value.");
     return Value{CopyObject(*args[0].GetObject_())};
 }
-static Value BuiltInTypeCtor_Array(AST::ExecuteContext& ctx, const PlaceInCode& place, std::vector<Value>&& args)
+static Value BuiltInTypeCtor_Array(AST::ExecuteContext& ctx, const PlaceInCode& place, ValueSpan args)
 {
     if(args.empty())
         return Value{std::make_shared<Array>()};
     MINSL_EXECUTION_CHECK(args.size() == 1 && args[0].GetType() == ValueType::Array, place, "Array can be constructed only from no arguments or from another array value.");
     return Value{CopyArray(*args[0].GetArray())};
 }
-static Value BuiltInTypeCtor_Function(AST::ExecuteContext& ctx, const PlaceInCode& place, std::vector<Value>&& args)
+static Value BuiltInTypeCtor_StringBuilder(AST::ExecuteContext& ctx, const PlaceInCode& place, ValueSpan args)
+{
+    auto sb = std::make_shared<StringBuilder>();
+    if(args.empty())
+        return Value{std::move(sb)};
+    MINSL_EXECUTION_CHECK(args.size() == 1 && (args[0].GetType() == ValueType::String || args[0].GetType() == ValueType::StringBuilder),
+        place, "StringBuilder can be constructed only from no arguments or from a string or another StringBuilder value.");
+    if(args[0].GetType() == ValueType::String)
+        sb->Str = std::move(args[0].GetString());
+    else
+        sb->Str = args[0].GetStringBuilder()->Str;
+    return Value{std::move(sb)};
+}
+static Value BuiltInTypeCtor_Function(AST::ExecuteContext& ctx, const PlaceInCode& place, ValueSpan args)
 {
     MINSL_EXECUTION_CHECK(args.size() == 1 && (args[0].GetType() == ValueType::Function || args[0].GetType() == ValueType::SystemFunction),
         place, "Function can be constructed only from another function value.");
     return Value{args[0]};
 }
-static Value BuiltInTypeCtor_Type(AST::ExecuteContext& ctx, const PlaceInCode& place, std::vector<Value>&& args)
+static Value BuiltInTypeCtor_Type(AST::ExecuteContext& ctx, const PlaceInCode& place, ValueSpan args)
 {
     MINSL_EXECUTION_CHECK(args.size() == 1 && args[0].GetType() == ValueType::Type, place, "Type can be constructed only from another type value.");
     return Value{args[0]};
 }
 
-static Value BuiltInFunction_typeOf(AST::ExecuteContext& ctx, const PlaceInCode& place, std::vector<Value>&& args)
+static Value BuiltInFunction_typeOf(AST::ExecuteContext& ctx, const PlaceInCode& place, ValueSpan args)
 {
     MINSL_EXECUTION_CHECK(args.size() == 1, place, ERROR_MESSAGE_EXPECTED_1_ARGUMENT);
     return Value{args[0].GetType()};
 }
 
-static Value BuiltInFunction_print(AST::ExecuteContext& ctx, const PlaceInCode& place, std::vector<Value>&& args)
+static Value BuiltInFunction_print(AST::ExecuteContext& ctx, const PlaceInCode& place, ValueSpan args)
 {
     string s;
     for(const auto& val : args)
@@ -1554,6 +2029,11 @@ static Value BuiltInFunction_print(AST::ExecuteContext& ctx, const PlaceInCode&
         case ValueType::Array:
             ctx.Env.Print("array\n");
             break;
+        case ValueType::StringBuilder:
+            if(!val.GetStringBuilder()->Str.empty())
+                ctx.Env.Print(val.GetStringBuilder()->Str);
+            ctx.Env.Print("\n");
+            break;
         case ValueType::Type:
         {
             const size_t typeIndex = (size_t)val.GetTypeValue();
@@ -1567,7 +2047,7 @@ static Value BuiltInFunction_print(AST::ExecuteContext& ctx, const PlaceInCode&
     }
     return {};
 }
-static Value BuiltInFunction_min(AST::ExecuteContext& ctx, const PlaceInCode& place, std::vector<Value>&& args)
+static Value BuiltInFunction_min(AST::ExecuteContext& ctx, const PlaceInCode& place, ValueSpan args)
 {
     const size_t argCount = args.size();
     MINSL_EXECUTION_CHECK(argCount > 0, place, "Built-in function min requires at least 1 argument.");
@@ -1581,7 +2061,7 @@ static Value BuiltInFunction_min(AST::ExecuteContext& ctx, const PlaceInCode& pl
     }
     return Value{result};
 }
-static Value BuiltInFunction_max(AST::ExecuteContext& ctx, const PlaceInCode& place, std::vector<Value>&& args)
+static Value BuiltInFunction_max(AST::ExecuteContext& ctx, const PlaceInCode& place, ValueSpan args)
 {
     const size_t argCount = args.size();
     MINSL_EXECUTION_CHECK(argCount > 0, place, "Built-in function min requires at least 1 argument.");
@@ -1596,27 +2076,32 @@ static Value BuiltInFunction_max(AST::ExecuteContext& ctx, const PlaceInCode& pl
     return Value{result};
 }
 
-static Value BuiltInMember_Object_Count(AST::ExecuteContext& ctx, const PlaceInCode& place, Value&& objVal)
+static Value BuiltInMember_Object_Count(AST::ExecuteContext& ctx, const PlaceInCode& place, const Value& objVal)
 {
     MINSL_EXECUTION_CHECK(objVal.GetType() == ValueType::Object && objVal.GetObject_(), place, ERROR_MESSAGE_EXPECTED_OBJECT);
     return Value{(double)objVal.GetObject_()->GetCount()};
 }
-static Value BuiltInMember_Array_Count(AST::ExecuteContext& ctx, const PlaceInCode& place, Value&& objVal)
+static Value BuiltInMember_Array_Count(AST::ExecuteContext& ctx, const PlaceInCode& place, const Value& objVal)
 {
     MINSL_EXECUTION_CHECK(objVal.GetType() == ValueType::Array && objVal.GetArray(), place, ERROR_MESSAGE_EXPECTED_ARRAY);
     return Value{(double)objVal.GetArray()->Items.size()};
 }
-static Value BuiltInMember_String_Count(AST::ExecuteContext& ctx, const PlaceInCode& place, Value&& objVal)
+static Value BuiltInMember_String_Count(AST::ExecuteContext& ctx, const PlaceInCode& place, const Value& objVal)
 {
     MINSL_EXECUTION_CHECK(objVal.GetType() == ValueType::String, place, ERROR_MESSAGE_EXPECTED_STRING);
     return Value{(double)objVal.GetString().length()};
 }
-static Value BuiltInFunction_String_resize(AST::ExecuteContext& ctx, const PlaceInCode& place, const AST::ThisType& th, std::vector<Value>&& args)
+static Value BuiltInMember_StringBuilder_Count(AST::ExecuteContext& ctx, const PlaceInCode& place, const Value& objVal)
+{
+    MINSL_EXECUTION_CHECK(objVal.GetType() == ValueType::StringBuilder && objVal.GetStringBuilder(), place, ERROR_MESSAGE_EXPECTED_STRING_BUILDER);
+    return Value{(double)objVal.GetStringBuilder()->Str.length()};
+}
+static Value BuiltInFunction_String_resize(AST::ExecuteContext& ctx, const PlaceInCode& place, const AST::ThisType& th, ValueSpan args)
 {
     // TODO
     return {};
 }
-static Value BuiltInFunction_Array_add(AST::ExecuteContext& ctx, const PlaceInCode& place, const AST::ThisType& th, std::vector<Value>&& args)
+static Value BuiltInFunction_Array_add(AST::ExecuteContext& ctx, const PlaceInCode& place, const AST::ThisType& th, ValueSpan args)
 {
     Array* arr = th.GetArray();
     MINSL_EXECUTION_CHECK(arr, place, ERROR_MESSAGE_EXPECTED_ARRAY);
@@ -1624,7 +2109,7 @@ static Value BuiltInFunction_Array_add(AST::ExecuteContext& ctx, const PlaceInCo
     arr->Items.push_back(std::move(args[0]));
     return {};
 }
-static Value BuiltInFunction_Array_insert(AST::ExecuteContext& ctx, const PlaceInCode& place, const AST::ThisType& th, std::vector<Value>&& args)
+static Value BuiltInFunction_Array_insert(AST::ExecuteContext& ctx, const PlaceInCode& place, const AST::ThisType& th, ValueSpan args)
 {
     Array* arr = th.GetArray();
     MINSL_EXECUTION_CHECK(arr, place, ERROR_MESSAGE_EXPECTED_ARRAY);
@@ -1634,7 +2119,7 @@ static Value BuiltInFunction_Array_insert(AST::ExecuteContext& ctx, const PlaceI
     arr->Items.insert(arr->Items.begin() + index, std::move(args[1]));
     return {};
 }
-static Value BuiltInFunction_Array_remove(AST::ExecuteContext& ctx, const PlaceInCode& place, const AST::ThisType& th, std::vector<Value>&& args)
+static Value BuiltInFunction_Array_remove(AST::ExecuteContext& ctx, const PlaceInCode& place, const AST::ThisType& th, ValueSpan args)
 {
     Array* arr = th.GetArray();
     MINSL_EXECUTION_CHECK(arr, place, ERROR_MESSAGE_EXPECTED_ARRAY);
@@ -1644,6 +2129,28 @@ static Value BuiltInFunction_Array_remove(AST::ExecuteContext& ctx, const PlaceI
     arr->Items.erase(arr->Items.begin() + index);
     return {};
 }
+static Value BuiltInFunction_StringBuilder_append(AST::ExecuteContext& ctx, const PlaceInCode& place, const AST::ThisType& th, ValueSpan args)
+{
+    StringBuilder* sb = th.GetStringBuilder();
+    MINSL_EXECUTION_CHECK(sb, place, ERROR_MESSAGE_EXPECTED_STRING_BUILDER);
+    for(const auto& arg : args)
+    {
+        if(arg.GetType() == ValueType::String)
+            sb->Str += arg.GetString();
+        else if(arg.GetType() == ValueType::StringBuilder)
+            sb->Str += arg.GetStringBuilder()->Str;
+        else
+            MINSL_EXECUTION_FAIL(place, ERROR_MESSAGE_EXPECTED_STRING);
+    }
+    return {};
+}
+static Value BuiltInFunction_StringBuilder_toString(AST::ExecuteContext& ctx, const PlaceInCode& place, const AST::ThisType& th, ValueSpan args)
+{
+    StringBuilder* sb = th.GetStringBuilder();
+    MINSL_EXECUTION_CHECK(sb, place, ERROR_MESSAGE_EXPECTED_STRING_BUILDER);
+    MINSL_EXECUTION_CHECK(args.empty(), place, ERROR_MESSAGE_INVALID_NUMBER_OF_ARGUMENTS);
+    return Value{string{sb->Str}};
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 // Abstract Syntax Tree implementation
@@ -1653,14 +2160,83 @@ namespace AST {
 #define DEBUG_PRINT_FORMAT_STR_BEG "(%u,%u) %s%.*s"
 #define DEBUG_PRINT_ARGS_BEG GetPlace().Row, GetPlace().Column, GetDebugPrintIndent(indentLevel), (int)prefix.length(), prefix.data()
 
+Value* ValueStack::Push(size_t count)
+{
+    if(count == 0)
+        return nullptr;
+    for(;;)
+    {
+        if(m_CurrChunkIndex == m_Chunks.size())
+        {
+            const size_t capacity = std::max(count, CHUNK_SIZE);
+            m_Chunks.push_back(Chunk{std::make_unique<Value[]>(capacity), capacity, 0});
+        }
+        Chunk& chunk = m_Chunks[m_CurrChunkIndex];
+        if(chunk.Capacity - chunk.Size >= count)
+        {
+            Value* const result = &chunk.Values[chunk.Size];
+            chunk.Size += count;
+            return result;
+        }
+        // Empty chunk that is too small can be replaced, as nothing points to it.
+        if(chunk.Size == 0)
+        {
+            chunk.Values = std::make_unique<Value[]>(count);
+            chunk.Capacity = count;
+        }
+        else
+            ++m_CurrChunkIndex;
+    }
+}
+
+void ValueStack::Pop(Value* values, size_t count)
+{
+    if(count == 0)
+        return;
+    Chunk& chunk = m_Chunks[m_CurrChunkIndex];
+    assert(chunk.Size >= count && values == &chunk.Values[chunk.Size - count]);
+    // Releasing referenced objects and strings now, not when the values are reused.
+    for(size_t i = 0; i < count; ++i)
+        values[i] = Value{};
+    chunk.Size -= count;
+    if(chunk.Size == 0 && m_CurrChunkIndex > 0)
+        --m_CurrChunkIndex;
+}
+
+void ExecuteContext::CreateLocalVariable(Object& localScope, const string& name, Value&& val)
+{
+    if(FreeLocalVariableNodes.empty())
+    {
+        localScope.GetOrCreateValue(name) = std::move(val);
+        return;
+    }
+    Object::MapType::node_type node = std::move(FreeLocalVariableNodes.back());
+    FreeLocalVariableNodes.pop_back();
+    node.key() = name;
+    node.mapped() = std::move(val);
+    localScope.m_Items.insert(std::move(node));
+}
+
+void ExecuteContext::ReleaseLocalScope(Object& localScope)
+{
+    while(!localScope.m_Items.empty())
+    {
+        Object::MapType::node_type node = localScope.m_Items.extract(localScope.m_Items.begin());
+        node.mapped() = Value{};
+        FreeLocalVariableNodes.push_back(std::move(node));
+    }
+}
+
 void Statement::Assign(const LValue& lhs, Value&& rhs) const
 {
     if(const ObjectMemberLValue* objMemberLhs = std::get_if<ObjectMemberLValue>(&lhs))
     {
         if(rhs.GetType() == ValueType::Null)
-            objMemberLhs->Obj->Remove(objMemberLhs->Key);
+            objMemberLhs->Obj->Remove(objMemberLhs->GetKey());
+        else if(objMemberLhs->Slot)
+            *objMemberLhs->Slot = std::move(rhs);
         else
-            objMemberLhs->Obj->GetOrCreateValue(objMemberLhs->Key) = std::move(rhs);
+            objMemberLhs->Obj->GetOrCreateValue(objMemberLhs->GetKey()) = std::move(rhs);
     }
     else if(const ArrayItemLValue* arrItemLhs = std::get_if<ArrayItemLValue>(&lhs))
     {
@@ -1695,12 +2271,37 @@ void Condition::DebugPrint(uint32_t indentLevel, const string_view& prefix) cons
 
 void Condition::Execute(ExecuteContext& ctx) const
 {
-    if(ConditionExpression->Evaluate(ctx, nullptr).IsTrue())
+    if(ConditionExpression->EvaluateCondition(ctx))
         Statements[0]->Execute(ctx);
     else if(Statements[1])
         Statements[1]->Execute(ctx);
 }
 
+unique_ptr<Statement> Condition::Optimize(Optimizer& optimizer)
+{
+    optimizer.Optimize(ConditionExpression);
+    optimizer.Optimize(Statements[0]);
+    optimizer.Optimize(Statements[1]);
+    if(const Value* condVal = ConditionExpression->GetConstantValue())
+    {
+        unique_ptr<Statement>& taken = Statements[condVal->IsTrue() ? 0 : 1];
+        if(taken)
+            return std::move(taken);
+        return std::make_unique<EmptyStatement>(GetPlace());
+    }
+    return {};
+}
+
+void Condition::CollectEffects(Effects& effects) const
+{
+    ConditionExpression->CollectEffects(effects);
+    for(const auto& stmt : Statements)
+    {
+        if(stmt)
+            stmt->CollectEffects(effects);
+    }
+}
+
 void WhileLoop::DebugPrint(uint32_t indentLevel, const string_view& prefix) const
 {
     const char* name = nullptr;
@@ -1721,7 +2322,7 @@ void WhileLoop::Execute(ExecuteContext& ctx) const
     switch(Type)
     {
     case WhileLoopType::While:
-        while(ConditionExpression->Evaluate(ctx, nullptr).IsTrue())
+        while(ConditionExpression->EvaluateCondition(ctx))
         {
             try
             {
@@ -1753,12 +2354,31 @@ void WhileLoop::Execute(ExecuteContext& ctx) const
                 continue;
             }
         }
-        while(ConditionExpression->Evaluate(ctx, nullptr).IsTrue());
+        while(ConditionExpression->EvaluateCondition(ctx));
         break;
     default: assert(0);
     }
 }
 
+unique_ptr<Statement> WhileLoop::Optimize(Optimizer& optimizer)
+{
+    optimizer.Optimize(ConditionExpression);
+    optimizer.Optimize(Body);
+    // Body of do-while loop executes at least once.
+    if(Type == WhileLoopType::While)
+    {
+        if(const Value* condVal = ConditionExpression->GetConstantValue(); condVal && !condVal->IsTrue())
+            return std::make_unique<EmptyStatement>(GetPlace());
+    }
+    return {};
+}
+
+void WhileLoop::CollectEffects(Effects& effects) const
+{
+    ConditionExpression->CollectEffects(effects);
+    Body->CollectEffects(effects);
+}
+
 void ForLoop::DebugPrint(uint32_t indentLevel, const string_view& prefix) const
 {
     printf(DEBUG_PRINT_FORMAT_STR_BEG "For\n", DEBUG_PRINT_ARGS_BEG);
@@ -1782,7 +2402,12 @@ void ForLoop::Execute(ExecuteContext& ctx) const
 {
     if(InitExpression)
         InitExpression->Execute(ctx);
-    while(ConditionExpression ? ConditionExpression->Evaluate(ctx, nullptr).IsTrue() : true)
+    ExecuteIterations(ctx);
+}
+
+void ForLoop::ExecuteIterations(ExecuteContext& ctx) const
+{
+    while(ConditionExpression ? ConditionExpression->EvaluateCondition(ctx) : true)
     {
         try
         {
@@ -1800,6 +2425,35 @@ void ForLoop::Execute(ExecuteContext& ctx) const
     }
 }
 
+unique_ptr<Statement> ForLoop::Optimize(Optimizer& optimizer)
+{
+    optimizer.Optimize(InitExpression);
+    optimizer.Optimize(ConditionExpression);
+    optimizer.Optimize(IterationExpression);
+    optimizer.Optimize(Body);
+    if(ConditionExpression)
+    {
+        if(const Value* condVal = ConditionExpression->GetConstantValue(); condVal && !condVal->IsTrue())
+        {
+            if(InitExpression)
+                return std::move(InitExpression);
+            return std::make_unique<EmptyStatement>(GetPlace());
+        }
+    }
+    return {};
+}
+
+void ForLoop::CollectEffects(Effects& effects) const
+{
+    if(InitExpression)
+        InitExpression->CollectEffects(effects);
+    if(ConditionExpression)
+        ConditionExpression->CollectEffects(effects);
+    if(IterationExpression)
+        IterationExpression->CollectEffects(effects);
+    Body->CollectEffects(effects);
+}
+
 void RangeBasedForLoop::DebugPrint(uint32_t indentLevel, const string_view& prefix) const
 {
     if(!KeyVarName.empty())
@@ -1825,8 +2479,7 @@ void RangeBasedForLoop::Execute(ExecuteContext& ctx) const
         {
             if(useKey)
                 Assign(LValue{ObjectMemberLValue{&innermostCtxObj, KeyVarName}}, Value{(double)i});
-            const char ch = rangeStr[i];
-            Assign(LValue{ObjectMemberLValue{&innermostCtxObj, ValueVarName}}, Value{string{&ch, &ch + 1}});
+            AssignSingleCharacterString(innermostCtxObj.GetOrCreateValue(ValueVarName), rangeStr[i]);
             try
             {
                 Body->Execute(ctx);
@@ -1889,6 +2542,22 @@ void RangeBasedForLoop::Execute(ExecuteContext& ctx) const
     Assign(LValue{ObjectMemberLValue{&innermostCtxObj, ValueVarName}}, Value{});
 }
 
+unique_ptr<Statement> RangeBasedForLoop::Optimize(Optimizer& optimizer)
+{
+    optimizer.Optimize(RangeExpression);
+    optimizer.Optimize(Body);
+    return {};
+}
+
+void RangeBasedForLoop::CollectEffects(Effects& effects) const
+{
+    RangeExpression->CollectEffects(effects);
+    Body->CollectEffects(effects);
+    if(!KeyVarName.empty())
+        effects.WrittenVariables.insert(KeyVarName);
+    effects.WrittenVariables.insert(ValueVarName);
+}
+
 void LoopBreakStatement::DebugPrint(uint32_t indentLevel, const string_view& prefix) const
 {
     static const char* LOOP_BREAK_TYPE_NAMES[] = { "Break", "Continue" };
@@ -1924,6 +2593,18 @@ void ReturnStatement::Execute(ExecuteContext& ctx) const
         throw ReturnException{GetPlace(), Value{}};
 }
 
+unique_ptr<Statement> ReturnStatement::Optimize(Optimizer& optimizer)
+{
+    optimizer.Optimize(ReturnedValue);
+    return {};
+}
+
+void ReturnStatement::CollectEffects(Effects& effects) const
+{
+    if(ReturnedValue)
+        ReturnedValue->CollectEffects(effects);
+}
+
 void Block::DebugPrint(uint32_t indentLevel, const string_view& prefix) const
 {
     printf(DEBUG_PRINT_FORMAT_STR_BEG "Block\n", DEBUG_PRINT_ARGS_BEG);
@@ -1938,6 +2619,45 @@ void Block::Execute(ExecuteContext& ctx) const
         stmtPtr->Execute(ctx);
 }
 
+// Returns true if execution never continues to the statement following this one.
+static bool IsJumpStatement(const Statement& stmt)
+{
+    return dynamic_cast<const ReturnStatement*>(&stmt) != nullptr ||
+        dynamic_cast<const ThrowStatement*>(&stmt) != nullptr ||
+        dynamic_cast<const LoopBreakStatement*>(&stmt) != nullptr;
+}
+
+unique_ptr<Statement> Block::Optimize(Optimizer& optimizer)
+{
+    vector<unique_ptr<Statement>> optimizedStatements;
+    optimizedStatements.reserve(Statements.size());
+    for(auto& stmtPtr : Statements)
+    {
+        optimizer.Optimize(stmtPtr);
+        if(Block* const nestedBlock = dynamic_cast<Block*>(stmtPtr.get()))
+        {
+            // Block doesn't introduce a scope, so statements of a nested block can be moved to this one.
+            for(auto& nestedStmtPtr : nestedBlock->Statements)
+                optimizedStatements.push_back(std::move(nestedStmtPtr));
+        }
+        // Constant expression used as a statement does nothing.
+        else if(dynamic_cast<const EmptyStatement*>(stmtPtr.get()) == nullptr &&
+            dynamic_cast<const ConstantExpression*>(stmtPtr.get()) == nullptr)
+            optimizedStatements.push_back(std::move(stmtPtr));
+        // Remaining statements are unreachable.
+        if(!optimizedStatements.empty() && IsJumpStatement(*optimizedStatements.back()))
+            break;
+    }
+    Statements = std::move(optimizedStatements);
+    return {};
+}
+
+void Block::CollectEffects(Effects& effects) const
+{
+    for(const auto& stmtPtr : Statements)
+        stmtPtr->CollectEffects(effects);
+}
+
 void SwitchStatement::DebugPrint(uint32_t indentLevel, const string_view& prefix) const
 {
     printf(DEBUG_PRINT_FORMAT_STR_BEG "switch\n", DEBUG_PRINT_ARGS_BEG);
@@ -1958,7 +2678,8 @@ void SwitchStatement::DebugPrint(uint32_t indentLevel, const string_view& prefix
 
 void SwitchStatement::Execute(ExecuteContext& ctx) const
 {
-    const Value condVal = Condition->Evaluate(ctx, nullptr);
+    Value condTemp;
+    const Value& condVal = Condition->EvaluateRef(ctx, condTemp, nullptr);
     size_t itemIndex, defaultItemIndex = SIZE_MAX;
     const size_t itemCount = ItemValues.size();
     for(itemIndex = 0; itemIndex < itemCount; ++itemIndex)
@@ -1989,6 +2710,27 @@ void SwitchStatement::Execute(ExecuteContext& ctx) const
     }
 }
 
+unique_ptr<Statement> SwitchStatement::Optimize(Optimizer& optimizer)
+{
+    optimizer.Optimize(Condition);
+    for(auto& itemBlock : ItemBlocks)
+    {
+        if(itemBlock)
+            itemBlock->Optimize(optimizer);
+    }
+    return {};
+}
+
+void SwitchStatement::CollectEffects(Effects& effects) const
+{
+    Condition->CollectEffects(effects);
+    for(const auto& itemBlock : ItemBlocks)
+    {
+        if(itemBlock)
+            itemBlock->CollectEffects(effects);
+    }
+}
+
 void ThrowStatement::DebugPrint(uint32_t indentLevel, const string_view& prefix) const
 {
     printf(DEBUG_PRINT_FORMAT_STR_BEG "throw\n", DEBUG_PRINT_ARGS_BEG);
@@ -2000,6 +2742,17 @@ void ThrowStatement::Execute(ExecuteContext& ctx) const
     throw ThrownExpression->Evaluate(ctx, nullptr);
 }
 
+unique_ptr<Statement> ThrowStatement::Optimize(Optimizer& optimizer)
+{
+    optimizer.Optimize(ThrownExpression);
+    return {};
+}
+
+void ThrowStatement::CollectEffects(Effects& effects) const
+{
+    ThrownExpression->CollectEffects(effects);
+}
+
 void TryStatement::DebugPrint(uint32_t indentLevel, const string_view& prefix) const
 {
     printf(DEBUG_PRINT_FORMAT_STR_BEG "try\n", DEBUG_PRINT_ARGS_BEG);
@@ -2089,6 +2842,26 @@ void TryStatement::Execute(ExecuteContext& ctx) const
         FinallyBlock->Execute(ctx);
 }
 
+unique_ptr<Statement> TryStatement::Optimize(Optimizer& optimizer)
+{
+    optimizer.Optimize(TryBlock);
+    optimizer.Optimize(CatchBlock);
+    optimizer.Optimize(FinallyBlock);
+    return {};
+}
+
+void TryStatement::CollectEffects(Effects& effects) const
+{
+    TryBlock->CollectEffects(effects);
+    if(CatchBlock)
+    {
+        effects.WrittenVariables.insert(ExceptionVarName);
+        CatchBlock->CollectEffects(effects);
+    }
+    if(FinallyBlock)
+        FinallyBlock->CollectEffects(effects);
+}
+
 void Script::Execute(ExecuteContext& ctx) const
 {
     try
@@ -2105,15 +2878,72 @@ void Script::Execute(ExecuteContext& ctx) const
     }
 }
 
-void ConstantValue::DebugPrint(uint32_t indentLevel, const string_view& prefix) const
+void CacheScope::DebugPrint(uint32_t indentLevel, const string_view& prefix) const
 {
-    switch(Val.GetType())
-    {
-    case ValueType::Null: printf(DEBUG_PRINT_FORMAT_STR_BEG "Constant null\n", DEBUG_PRINT_ARGS_BEG); break;
-    case ValueType::Number: printf(DEBUG_PRINT_FORMAT_STR_BEG "Constant number: %g\n", DEBUG_PRINT_ARGS_BEG, Val.GetNumber()); break;
-    case ValueType::String: printf(DEBUG_PRINT_FORMAT_STR_BEG "Constant string: %s\n", DEBUG_PRINT_ARGS_BEG, Val.GetString().c_str()); break;
-    default: assert(0 && "ConstantValue should not be used with this type.");
-    }
+    printf(DEBUG_PRINT_FORMAT_STR_BEG "Cache scope, %zu slots\n", DEBUG_PRINT_ARGS_BEG, Slots.size());
+    Inner->DebugPrint(indentLevel + 1, "Inner: ");
+}
+
+void CacheScope::Execute(ExecuteContext& ctx) const
+{
+    if(ctx.CachedValues.size() <= Slots.back())
+        ctx.CachedValues.resize(Slots.back() + 1);
+    // Values must not be reused by the next execution, also when it's left by an exception.
+    struct SlotRelease
+    {
+        ExecuteContext& Ctx;
+        const vector<size_t>& Slots;
+        ~SlotRelease()
+        {
+            for(size_t slot : Slots)
+                Ctx.CachedValues[slot] = ExecuteContext::CachedValue{};
+        }
+    } slotRelease{ctx, Slots};
+    Inner->Execute(ctx);
+}
+
+unique_ptr<Statement> Expression::Optimize(Optimizer& optimizer)
+{
+    // Value of expression used as a statement is ignored.
+    OptimizeOperands(optimizer);
+    return Simplify(optimizer, true);
+}
+
+// Adds effects of assigning to given l-value, not including evaluation of the l-value expression itself.
+static void CollectWriteEffects(const Expression& lvalue, Effects& effects)
+{
+    if(const Identifier* identifier = dynamic_cast<const Identifier*>(&lvalue))
+    {
+        effects.WrittenVariables.insert(identifier->S);
+        return;
+    }
+    effects.WritesMembers = true;
+    // Assigning to a character modifies string stored in the indexed variable.
+    if(const BinaryOperator* indexing = dynamic_cast<const BinaryOperator*>(&lvalue);
+        indexing && indexing->Type == BinaryOperatorType::Indexing)
+        CollectWriteEffects(*indexing->Operands[0], effects);
+}
+
+void ConstantValue::DebugPrint(uint32_t indentLevel, const string_view& prefix) const
+{
+    switch(Val.GetType())
+    {
+    case ValueType::Null: printf(DEBUG_PRINT_FORMAT_STR_BEG "Constant null\n", DEBUG_PRINT_ARGS_BEG); break;
+    case ValueType::Number: printf(DEBUG_PRINT_FORMAT_STR_BEG "Constant number: %g\n", DEBUG_PRINT_ARGS_BEG, Val.GetNumber()); break;
+    case ValueType::String: printf(DEBUG_PRINT_FORMAT_STR_BEG "Constant string: %s\n", DEBUG_PRINT_ARGS_BEG, Val.GetString().c_str()); break;
+    default: assert(0 && "ConstantValue should not be used with this type.");
+    }
+}
+
+bool ConstantValue::AppendKey(string& out) const
+{
+    switch(Val.GetType())
+    {
+    case ValueType::Null: out += "null"; return true;
+    case ValueType::Number: out += Format("%a", Val.GetNumber()); return true;
+    case ValueType::String: out += Format("'%zu:", Val.GetString().length()); out += Val.GetString(); return true;
+    }
+    return false;
 }
 
 void Identifier::DebugPrint(uint32_t indentLevel, const string_view& prefix) const
@@ -2123,7 +2953,7 @@ void Identifier::DebugPrint(uint32_t indentLevel, const string_view& prefix) con
     printf(DEBUG_PRINT_FORMAT_STR_BEG "Identifier: %s%s\n", DEBUG_PRINT_ARGS_BEG, PREFIX[(size_t)Scope], S.c_str());
 }
 
-Value Identifier::Evaluate(ExecuteContext& ctx, ThisType* outThis) const
+const Value& Identifier::EvaluateRef(ExecuteContext& ctx, Value& outTemp, ThisType* outThis) const
 {
     MINSL_EXECUTION_CHECK(Scope != IdentifierScope::Local || ctx.IsLocal(), GetPlace(), ERROR_MESSAGE_NO_LOCAL_SCOPE);
 
@@ -2157,15 +2987,15 @@ Value Identifier::Evaluate(ExecuteContext& ctx, ThisType* outThis) const
         // Type
         for(size_t i = 0, count = (size_t)ValueType::Count; i < count; ++i)
             if(S == VALUE_TYPE_NAMES[i])
-                return Value{(ValueType)i};
+                return outTemp = Value{(ValueType)i};
         // System function
         for(size_t i = 0, count = (size_t)SystemFunction::Count; i < count; ++i)
             if(S == SYSTEM_FUNCTION_NAMES[i])
-                return Value{(SystemFunction)i};
+                return outTemp = Value{(SystemFunction)i};
     }
 
     // Not found - null
-    return {};
+    return outTemp = Value{};
 }
 
 LValue Identifier::GetLValue(ExecuteContext& ctx) const
@@ -2176,19 +3006,22 @@ LValue Identifier::GetLValue(ExecuteContext& ctx) const
     if(isLocal)
     {
         // Local variable
-        if((Scope == IdentifierScope::None || Scope == IdentifierScope::Local) && ctx.GetCurrentLocalScope()->HasKey(S))
-            return LValue{ObjectMemberLValue{&*ctx.GetCurrentLocalScope(), S}};
+        if(Scope == IdentifierScope::None || Scope == IdentifierScope::Local)
+            if(Value* val = ctx.GetCurrentLocalScope()->TryGetValue(S); val)
+                return LValue{ObjectMemberLValue{ctx.GetCurrentLocalScope(), S, val}};
         // This
         if(Scope == IdentifierScope::None)
         {
-            if(const shared_ptr<Object>* thisObj = std::get_if<shared_ptr<Object>>(&ctx.GetThis()); thisObj && (*thisObj)->HasKey(S))
-                return LValue{ObjectMemberLValue{(*thisObj).get(), S}};
+            if(const shared_ptr<Object>* thisObj = std::get_if<shared_ptr<Object>>(&ctx.GetThis()); thisObj)
+                if(Value* val = (*thisObj)->TryGetValue(S); val)
+                    return LValue{ObjectMemberLValue{(*thisObj).get(), S, val}};
         }
     }    
     
     // Global variable
-    if((Scope == IdentifierScope::None || Scope == IdentifierScope::Global) && ctx.GlobalScope.HasKey(S))
-        return LValue{ObjectMemberLValue{&ctx.GlobalScope, S}};
+    if(Scope == IdentifierScope::None || Scope == IdentifierScope::Global)
+        if(Value* val = ctx.GlobalScope.TryGetValue(S); val)
+            return LValue{ObjectMemberLValue{&ctx.GlobalScope, S, val}};
 
     // Not found: return reference to smallest scope.
     if((Scope == IdentifierScope::None || Scope == IdentifierScope::Local) && isLocal)
@@ -2196,6 +3029,13 @@ LValue Identifier::GetLValue(ExecuteContext& ctx) const
     return LValue{ObjectMemberLValue{&ctx.GlobalScope, S}};
 }
 
+bool Identifier::AppendKey(string& out) const
+{
+    out += Format("$%u:%zu:", (uint32_t)Scope, S.length());
+    out += S;
+    return true;
+}
+
 void ThisExpression::DebugPrint(uint32_t indentLevel, const string_view& prefix) const
 {
     printf(DEBUG_PRINT_FORMAT_STR_BEG "This\n", DEBUG_PRINT_ARGS_BEG);
@@ -2220,11 +3060,7 @@ void UnaryOperator::DebugPrint(uint32_t indentLevel, const string_view& prefix)
 
 Value UnaryOperator::Evaluate(ExecuteContext& ctx, ThisType* outThis) const
 {
-    // Those require l-value.
-    if(Type == UnaryOperatorType::Preincrementation ||
-        Type == UnaryOperatorType::Predecrementation ||
-        Type == UnaryOperatorType::Postincrementation ||
-        Type == UnaryOperatorType::Postdecrementation)
+    if(RequiresLValue())
     {
         Value* val = Operand->GetLValue(ctx).GetValueRef(GetPlace());
         MINSL_EXECUTION_CHECK( val->GetType() == ValueType::Number, GetPlace(), ERROR_MESSAGE_EXPECTED_NUMBER );
@@ -2253,20 +3089,34 @@ Value UnaryOperator::Evaluate(ExecuteContext& ctx, ThisType* outThis) const
         Type == UnaryOperatorType::LogicalNot ||
         Type == UnaryOperatorType::BitwiseNot)
     {
-        Value val = Operand->Evaluate(ctx, nullptr);
+        Value valTemp;
+        const Value& val = Operand->EvaluateRef(ctx, valTemp, nullptr);
         MINSL_EXECUTION_CHECK( val.GetType() == ValueType::Number, GetPlace(), ERROR_MESSAGE_EXPECTED_NUMBER );
         switch(Type)
         {
-        case UnaryOperatorType::Plus: return val;
+        case UnaryOperatorType::Plus: return Value{val.GetNumber()};
         case UnaryOperatorType::Minus: return Value{-val.GetNumber()};
         case UnaryOperatorType::LogicalNot: return Value{val.IsTrue() ? 0.0 : 1.0};
-        case UnaryOperatorType::BitwiseNot: return BitwiseNot(std::move(val));
+        case UnaryOperatorType::BitwiseNot: return BitwiseNot(val);
         default: assert(0); return {};
         }
     }
     assert(0); return {};
 }
 
+bool UnaryOperator::HasSideEffects() const
+{
+    switch(Type)
+    {
+    case UnaryOperatorType::Preincrementation:
+    case UnaryOperatorType::Predecrementation:
+    case UnaryOperatorType::Postincrementation:
+    case UnaryOperatorType::Postdecrementation:
+        return true;
+    }
+    return Operand->HasSideEffects();
+}
+
 LValue UnaryOperator::GetLValue(ExecuteContext& ctx) const
 {
     if(Type == UnaryOperatorType::Preincrementation || Type == UnaryOperatorType::Predecrementation)
@@ -2274,7 +3124,7 @@ LValue UnaryOperator::GetLValue(ExecuteContext& ctx) const
         LValue lval = Operand->GetLValue(ctx);
         const ObjectMemberLValue* objMemberLval = std::get_if<ObjectMemberLValue>(&lval);
         MINSL_EXECUTION_CHECK( objMemberLval, GetPlace(), ERROR_MESSAGE_INVALID_LVALUE );
-        Value* val = objMemberLval->Obj->TryGetValue(objMemberLval->Key);
+        Value* val = objMemberLval->TryGetValue();
         MINSL_EXECUTION_CHECK( val != nullptr, GetPlace(), ERROR_MESSAGE_VARIABLE_DOESNT_EXIST );
         MINSL_EXECUTION_CHECK( val->GetType() == ValueType::Number, GetPlace(), ERROR_MESSAGE_EXPECTED_NUMBER );
         switch(Type)
@@ -2287,15 +3137,54 @@ LValue UnaryOperator::GetLValue(ExecuteContext& ctx) const
     MINSL_EXECUTION_FAIL(GetPlace(), ERROR_MESSAGE_INVALID_LVALUE);
 }
 
+void UnaryOperator::OptimizeOperands(Optimizer& optimizer)
+{
+    optimizer.Optimize(Operand, !RequiresLValue());
+}
+
+unique_ptr<Expression> UnaryOperator::Simplify(Optimizer& optimizer, bool valueOnly)
+{
+    if(!RequiresLValue() && Operand->GetConstantValue())
+        return optimizer.TryFold(*this);
+    return {};
+}
+
+bool UnaryOperator::AppendKey(string& out) const
+{
+    if(RequiresLValue())
+        return false;
+    out += Format("u%u(", (uint32_t)Type);
+    if(!Operand->AppendKey(out))
+        return false;
+    out += ')';
+    return true;
+}
+
+void UnaryOperator::CollectEffects(Effects& effects) const
+{
+    Operand->CollectEffects(effects);
+    if(RequiresLValue())
+        CollectWriteEffects(*Operand, effects);
+}
+
+bool UnaryOperator::RequiresLValue() const
+{
+    return Type == UnaryOperatorType::Preincrementation ||
+        Type == UnaryOperatorType::Predecrementation ||
+        Type == UnaryOperatorType::Postincrementation ||
+        Type == UnaryOperatorType::Postdecrementation;
+}
+
 void MemberAccessOperator::DebugPrint(uint32_t indentLevel, const string_view& prefix) const
 {
     printf(DEBUG_PRINT_FORMAT_STR_BEG "MemberAccessOperator Member=%s\n", DEBUG_PRINT_ARGS_BEG, MemberName.c_str());
     Operand->DebugPrint(indentLevel + 1, "Operand: ");
 }
 
-Value MemberAccessOperator::Evaluate(ExecuteContext& ctx, ThisType* outThis) const
+const Value& MemberAccessOperator::EvaluateRef(ExecuteContext& ctx, Value& outTemp, ThisType* outThis) const
 {
-    Value objVal = Operand->Evaluate(ctx, nullptr);
+    Value objTemp;
+    const Value& objVal = Operand->EvaluateRef(ctx, objTemp, nullptr);
     if(objVal.GetType() == ValueType::Object)
     {
         const Value* memberVal = objVal.GetObject_()->TryGetValue(MemberName);
@@ -2303,26 +3192,38 @@ Value MemberAccessOperator::Evaluate(ExecuteContext& ctx, ThisType* outThis) con
         {
             if(outThis)
                 *outThis = ThisType{objVal.GetObjectPtr()};
+            // Member of a temporary object must be copied out before the object is destroyed.
+            if(&objVal == &objTemp)
+                return outTemp = *memberVal;
             return *memberVal;
         }
         if(MemberName == "count")
-            return BuiltInMember_Object_Count(ctx, GetPlace(), std::move(objVal));
-        return {};
+            return outTemp = BuiltInMember_Object_Count(ctx, GetPlace(), objVal);
+        return outTemp = Value{};
     }
     if(objVal.GetType() == ValueType::String)
     {
-        if(MemberName == "count") return BuiltInMember_String_Count(ctx, GetPlace(), std::move(objVal));
-        else if(MemberName == "resize") return Value{SystemFunction::String_resize};
+        if(MemberName == "count") return outTemp = BuiltInMember_String_Count(ctx, GetPlace(), objVal);
+        else if(MemberName == "resize") return outTemp = Value{SystemFunction::String_resize};
         MINSL_EXECUTION_FAIL(GetPlace(), ERROR_MESSAGE_INVALID_MEMBER);
     }
     if(objVal.GetType() == ValueType::Array)
     {
         if(outThis)
             *outThis = ThisType{objVal.GetArrayPtr()};
-        if(MemberName == "count") return BuiltInMember_Array_Count(ctx, GetPlace(), std::move(objVal));
-        else if(MemberName == "add") return Value{SystemFunction::Array_add};
-        else if(MemberName == "insert") return Value{SystemFunction::Array_insert};
-        else if(MemberName == "remove") return Value{SystemFunction::Array_remove};
+        if(MemberName == "count") return outTemp = BuiltInMember_Array_Count(ctx, GetPlace(), objVal);
+        else if(MemberName == "add") return outTemp = Value{SystemFunction::Array_add};
+        else if(MemberName == "insert") return outTemp = Value{SystemFunction::Array_insert};
+        else if(MemberName == "remove") return outTemp = Value{SystemFunction::Array_remove};
+        MINSL_EXECUTION_FAIL(GetPlace(), ERROR_MESSAGE_INVALID_MEMBER);
+    }
+    if(objVal.GetType() == ValueType::StringBuilder)
+    {
+        if(outThis)
+            *outThis = ThisType{objVal.GetStringBuilderPtr()};
+        if(MemberName == "count") return outTemp = BuiltInMember_StringBuilder_Count(ctx, GetPlace(), objVal);
+        else if(MemberName == "append") return outTemp = Value{SystemFunction::StringBuilder_append};
+        else if(MemberName == "toString") return outTemp = Value{SystemFunction::StringBuilder_toString};
         MINSL_EXECUTION_FAIL(GetPlace(), ERROR_MESSAGE_INVALID_MEMBER);
     }
     MINSL_EXECUTION_FAIL(GetPlace(), ERROR_MESSAGE_INVALID_TYPE);
@@ -2335,7 +3236,37 @@ LValue MemberAccessOperator::GetLValue(ExecuteContext& ctx) const
     return LValue{ObjectMemberLValue{objVal.GetObject_(), MemberName}};
 }
 
-Value UnaryOperator::BitwiseNot(Value&& operand) const
+void MemberAccessOperator::OptimizeOperands(Optimizer& optimizer)
+{
+    optimizer.Optimize(Operand);
+}
+
+unique_ptr<Expression> MemberAccessOperator::Simplify(Optimizer& optimizer, bool valueOnly)
+{
+    // Like 'abc'.count
+    if(Operand->GetConstantValue())
+        return optimizer.TryFold(*this);
+    return {};
+}
+
+bool MemberAccessOperator::AppendKey(string& out) const
+{
+    out += Format(".%zu:", MemberName.length());
+    out += MemberName;
+    out += '(';
+    if(!Operand->AppendKey(out))
+        return false;
+    out += ')';
+    return true;
+}
+
+void MemberAccessOperator::CollectEffects(Effects& effects) const
+{
+    effects.ReadsMembers = true;
+    Operand->CollectEffects(effects);
+}
+
+Value UnaryOperator::BitwiseNot(const Value& operand) const
 {
     const int64_t operandInt = (int64_t)operand.GetNumber();
     const int64_t resultInt = ~operandInt;
@@ -2366,6 +3297,10 @@ Value BinaryOperator::Evaluate(ExecuteContext& ctx, ThisType* outThis) const
         Operands[0]->Execute(ctx);
         return Operands[1]->Evaluate(ctx, outThis);
     }
+
+    // This one can return reference to existing object member or array item.
+    if(Type == BinaryOperatorType::Indexing)
+        return EvaluateViaRef(ctx, outThis);
     
     // Operators that require l-value.
     switch(Type)
@@ -2390,24 +3325,32 @@ Value BinaryOperator::Evaluate(ExecuteContext& ctx, ThisType* outThis) const
     }
     
     // Remaining operators use r-values.
-    Value lhs = Operands[0]->Evaluate(ctx, nullptr);
+    // Left operand can be borrowed only if evaluating the right one cannot modify or destroy it.
+    // Logical operators don't use left operand after evaluating the right one.
+    const bool canBorrowLhs = Type == BinaryOperatorType::LogicalAnd || Type == BinaryOperatorType::LogicalOr ||
+        !Operands[1]->HasSideEffects();
+    Value lhsTemp;
+    const Value& lhs = canBorrowLhs ?
+        Operands[0]->EvaluateRef(ctx, lhsTemp, nullptr) :
+        (lhsTemp = Operands[0]->Evaluate(ctx, nullptr));
 
     // Logical operators with short circuit for right hand side operand.
     if(Type == BinaryOperatorType::LogicalAnd)
     {
         if(!lhs.IsTrue())
-            return lhs;
+            return TakeEvaluatedValue(lhs, lhsTemp);
         return Operands[1]->Evaluate(ctx, nullptr);
     }
     if(Type == BinaryOperatorType::LogicalOr)
     {
         if(lhs.IsTrue())
-            return lhs;
+            return TakeEvaluatedValue(lhs, lhsTemp);
         return Operands[1]->Evaluate(ctx, nullptr);
     }
 
     // Remaining operators use both operands as r-values.
-    Value rhs = Operands[1]->Evaluate(ctx, nullptr);
+    Value rhsTemp;
+    const Value& rhs = Operands[1]->EvaluateRef(ctx, rhsTemp, nullptr);
 
     const ValueType lhsType = lhs.GetType();
     const ValueType rhsType = rhs.GetType();
@@ -2418,7 +3361,15 @@ Value BinaryOperator::Evaluate(ExecuteContext& ctx, ThisType* outThis) const
         if(lhsType == ValueType::Number && rhsType == ValueType::Number)
             return Value{lhs.GetNumber() + rhs.GetNumber()};
         if(lhsType == ValueType::String && rhsType == ValueType::String)
+        {
+            // If lhs is our own temporary, append to it in place instead of allocating a third string.
+            if(&lhs == &lhsTemp)
+            {
+                lhsTemp.GetString() += rhs.GetString();
+                return std::move(lhsTemp);
+            }
             return Value{lhs.GetString() + rhs.GetString()};
+        }
         MINSL_EXECUTION_FAIL(GetPlace(), ERROR_MESSAGE_INCOMPATIBLE_TYPES);
     }
     if(Type == BinaryOperatorType::Equal)
@@ -2460,36 +3411,6 @@ Value BinaryOperator::Evaluate(ExecuteContext& ctx, ThisType* outThis) const
             MINSL_EXECUTION_FAIL(GetPlace(), ERROR_MESSAGE_INVALID_TYPE);
         return Value{result ? 1.0 : 0.0};
     }
-    if(Type == BinaryOperatorType::Indexing)
-    {
-        if(lhsType == ValueType::String)
-        {
-            MINSL_EXECUTION_CHECK( rhsType == ValueType::Number, GetPlace(), ERROR_MESSAGE_EXPECTED_NUMBER );
-            size_t index = 0;
-            MINSL_EXECUTION_CHECK( NumberToIndex(index, rhs.GetNumber()), GetPlace(), ERROR_MESSAGE_INVALID_INDEX );
-            MINSL_EXECUTION_CHECK( index < lhs.GetString().length(), GetPlace(), ERROR_MESSAGE_INDEX_OUT_OF_BOUNDS );
-            return Value{string(1, lhs.GetString()[index])};
-        }
-        if(lhsType == ValueType::Object)
-        {
-            MINSL_EXECUTION_CHECK( rhsType == ValueType::String, GetPlace(), ERROR_MESSAGE_EXPECTED_STRING );
-            if(Value* val = lhs.GetObject_()->TryGetValue(rhs.GetString()))
-            {
-                if(outThis)
-                    *outThis = ThisType{lhs.GetObjectPtr()};
-                return *val;
-            }
-            return {};
-        }
-        if(lhsType == ValueType::Array)
-        {
-            MINSL_EXECUTION_CHECK( rhsType == ValueType::Number, GetPlace(), ERROR_MESSAGE_EXPECTED_NUMBER );
-            size_t index;
-            MINSL_EXECUTION_CHECK( NumberToIndex(index, rhs.GetNumber()) && index < lhs.GetArray()->Items.size(), GetPlace(), ERROR_MESSAGE_INVALID_INDEX );
-            return lhs.GetArray()->Items[index];
-        }
-        MINSL_EXECUTION_FAIL(GetPlace(), ERROR_MESSAGE_INVALID_TYPE);
-    }
 
     // Remaining operators require numbers.
     CheckNumberOperand(Operands[0].get(), lhs);
@@ -2501,8 +3422,8 @@ Value BinaryOperator::Evaluate(ExecuteContext& ctx, ThisType* outThis) const
     case BinaryOperatorType::Div:          return Value{lhs.GetNumber() / rhs.GetNumber()};
     case BinaryOperatorType::Mod:          return Value{fmod(lhs.GetNumber(), rhs.GetNumber())};
     case BinaryOperatorType::Sub:          return Value{lhs.GetNumber() - rhs.GetNumber()};
-    case BinaryOperatorType::ShiftLeft:    return ShiftLeft(std::move(lhs), std::move(rhs));
-    case BinaryOperatorType::ShiftRight:   return ShiftRight(std::move(lhs), std::move(rhs));
+    case BinaryOperatorType::ShiftLeft:    return ShiftLeft(lhs, rhs);
+    case BinaryOperatorType::ShiftRight:   return ShiftRight(lhs, rhs);
     case BinaryOperatorType::BitwiseAnd:   return Value{ (double)( (int64_t)lhs.GetNumber() & (int64_t)rhs.GetNumber() ) };
     case BinaryOperatorType::BitwiseXor:   return Value{ (double)( (int64_t)lhs.GetNumber() ^ (int64_t)rhs.GetNumber() ) };
     case BinaryOperatorType::BitwiseOr:    return Value{ (double)( (int64_t)lhs.GetNumber() | (int64_t)rhs.GetNumber() ) };
@@ -2511,12 +3432,92 @@ Value BinaryOperator::Evaluate(ExecuteContext& ctx, ThisType* outThis) const
     assert(0); return {};
 }
 
+const Value& BinaryOperator::EvaluateRef(ExecuteContext& ctx, Value& outTemp, ThisType* outThis) const
+{
+    if(Type == BinaryOperatorType::Comma)
+    {
+        Operands[0]->Execute(ctx);
+        return Operands[1]->EvaluateRef(ctx, outTemp, outThis);
+    }
+    if(Type != BinaryOperatorType::Indexing)
+        return outTemp = Evaluate(ctx, outThis);
+
+    Value lhsTemp;
+    const Value& lhs = !Operands[1]->HasSideEffects() ?
+        Operands[0]->EvaluateRef(ctx, lhsTemp, nullptr) :
+        (lhsTemp = Operands[0]->Evaluate(ctx, nullptr));
+    Value rhsTemp;
+    const Value& rhs = Operands[1]->EvaluateRef(ctx, rhsTemp, nullptr);
+    // Item of a temporary object or array must be copied out before it is destroyed.
+    const bool lhsBorrowed = &lhs != &lhsTemp;
+
+    const ValueType lhsType = lhs.GetType();
+    const ValueType rhsType = rhs.GetType();
+    if(lhsType == ValueType::String)
+    {
+        MINSL_EXECUTION_CHECK( rhsType == ValueType::Number, GetPlace(), ERROR_MESSAGE_EXPECTED_NUMBER );
+        size_t index = 0;
+        MINSL_EXECUTION_CHECK( NumberToIndex(index, rhs.GetNumber()), GetPlace(), ERROR_MESSAGE_INVALID_INDEX );
+        MINSL_EXECUTION_CHECK( index < lhs.GetString().length(), GetPlace(), ERROR_MESSAGE_INDEX_OUT_OF_BOUNDS );
+        AssignSingleCharacterString(outTemp, lhs.GetString()[index]);
+        return outTemp;
+    }
+    if(lhsType == ValueType::Object)
+    {
+        MINSL_EXECUTION_CHECK( rhsType == ValueType::String, GetPlace(), ERROR_MESSAGE_EXPECTED_STRING );
+        if(const Value* val = lhs.GetObject_()->TryGetValue(rhs.GetString()))
+        {
+            if(outThis)
+                *outThis = ThisType{lhs.GetObjectPtr()};
+            if(lhsBorrowed)
+                return *val;
+            return outTemp = *val;
+        }
+        return outTemp = Value{};
+    }
+    if(lhsType == ValueType::Array)
+    {
+        MINSL_EXECUTION_CHECK( rhsType == ValueType::Number, GetPlace(), ERROR_MESSAGE_EXPECTED_NUMBER );
+        size_t index;
+        MINSL_EXECUTION_CHECK( NumberToIndex(index, rhs.GetNumber()) && index < lhs.GetArray()->Items.size(), GetPlace(), ERROR_MESSAGE_INVALID_INDEX );
+        if(lhsBorrowed)
+            return lhs.GetArray()->Items[index];
+        return outTemp = lhs.GetArray()->Items[index];
+    }
+    MINSL_EXECUTION_FAIL(GetPlace(), ERROR_MESSAGE_INVALID_TYPE);
+}
+
+bool BinaryOperator::HasSideEffects() const
+{
+    return IsAssignment() || Operands[0]->HasSideEffects() || Operands[1]->HasSideEffects();
+}
+
+bool BinaryOperator::IsAssignment() const
+{
+    switch(Type)
+    {
+    case BinaryOperatorType::Assignment:
+    case BinaryOperatorType::AssignmentAdd:
+    case BinaryOperatorType::AssignmentSub:
+    case BinaryOperatorType::AssignmentMul:
+    case BinaryOperatorType::AssignmentDiv:
+    case BinaryOperatorType::AssignmentMod:
+    case BinaryOperatorType::AssignmentShiftLeft:
+    case BinaryOperatorType::AssignmentShiftRight:
+    case BinaryOperatorType::AssignmentBitwiseAnd:
+    case BinaryOperatorType::AssignmentBitwiseXor:
+    case BinaryOperatorType::AssignmentBitwiseOr:
+        return true;
+    }
+    return false;
+}
+
 LValue BinaryOperator::GetLValue(ExecuteContext& ctx) const
 {
     if(Type == BinaryOperatorType::Indexing)
     {
         Value* leftValRef = Operands[0]->GetLValue(ctx).GetValueRef(GetPlace());
-        const Value indexVal = Operands[1]->Evaluate(ctx, nullptr);
+        Value indexVal = Operands[1]->Evaluate(ctx, nullptr);
         if(leftValRef->GetType() == ValueType::String)
         {
             MINSL_EXECUTION_CHECK( indexVal.GetType() == ValueType::Number, GetPlace(), ERROR_MESSAGE_EXPECTED_NUMBER );
@@ -2527,7 +3528,7 @@ LValue BinaryOperator::GetLValue(ExecuteContext& ctx) const
         if(leftValRef->GetType() == ValueType::Object)
         {
             MINSL_EXECUTION_CHECK( indexVal.GetType() == ValueType::String, GetPlace(), ERROR_MESSAGE_EXPECTED_STRING );
-            return LValue{ObjectMemberLValue{leftValRef->GetObject_(), indexVal.GetString()}};
+            return LValue{ObjectMemberLValue{leftValRef->GetObject_(), std::move(indexVal.GetString())}};
         }
         if(leftValRef->GetType() == ValueType::Array)
         {
@@ -2540,6 +3541,63 @@ LValue BinaryOperator::GetLValue(ExecuteContext& ctx) const
     return __super::GetLValue(ctx);
 }
 
+void BinaryOperator::OptimizeOperands(Optimizer& optimizer)
+{
+    optimizer.Optimize(Operands[0], !IsAssignment() && Type != BinaryOperatorType::Indexing);
+    // Right operand of comma passes 'this' for a function call.
+    optimizer.Optimize(Operands[1], Type != BinaryOperatorType::Comma);
+}
+
+unique_ptr<Expression> BinaryOperator::Simplify(Optimizer& optimizer, bool valueOnly)
+{
+    const Value* const lhsVal = Operands[0]->GetConstantValue();
+    if(Type == BinaryOperatorType::Comma)
+    {
+        if(lhsVal && valueOnly)
+            return std::move(Operands[1]);
+        return {};
+    }
+    if(Type == BinaryOperatorType::LogicalAnd || Type == BinaryOperatorType::LogicalOr)
+    {
+        if(lhsVal && valueOnly)
+        {
+            // Short circuit returns the left operand, otherwise value of the right one is returned.
+            if(lhsVal->IsTrue() == (Type == BinaryOperatorType::LogicalOr))
+                return std::move(Operands[0]);
+            return std::move(Operands[1]);
+        }
+        return {};
+    }
+    // Assignment to a constant fails to fold and is left to report the error.
+    if(lhsVal && Operands[1]->GetConstantValue())
+        return optimizer.TryFold(*this);
+    return {};
+}
+
+bool BinaryOperator::AppendKey(string& out) const
+{
+    if(IsAssignment() || Type == BinaryOperatorType::Comma)
+        return false;
+    out += Format("b%u(", (uint32_t)Type);
+    if(!Operands[0]->AppendKey(out))
+        return false;
+    out += ',';
+    if(!Operands[1]->AppendKey(out))
+        return false;
+    out += ')';
+    return true;
+}
+
+void BinaryOperator::CollectEffects(Effects& effects) const
+{
+    Operands[0]->CollectEffects(effects);
+    Operands[1]->CollectEffects(effects);
+    if(IsAssignment())
+        CollectWriteEffects(*Operands[0], effects);
+    else if(Type == BinaryOperatorType::Indexing)
+        effects.ReadsMembers = true;
+}
+
 Value BinaryOperator::ShiftLeft(const Value& lhs, const Value& rhs) const
 {
     const int64_t lhsInt = (int64_t)lhs.GetNumber();
@@ -2609,14 +3667,56 @@ void TernaryOperator::DebugPrint(uint32_t indentLevel, const string_view& prefix
     Operands[2]->DebugPrint(indentLevel, "FalseExpression: ");
 }
 
-Value TernaryOperator::Evaluate(ExecuteContext& ctx, ThisType* outThis) const
+const Value& TernaryOperator::EvaluateRef(ExecuteContext& ctx, Value& outTemp, ThisType* outThis) const
+{
+    return Operands[0]->EvaluateCondition(ctx) ?
+        Operands[1]->EvaluateRef(ctx, outTemp, outThis) :
+        Operands[2]->EvaluateRef(ctx, outTemp, outThis);
+}
+
+bool TernaryOperator::HasSideEffects() const
+{
+    return Operands[0]->HasSideEffects() || Operands[1]->HasSideEffects() || Operands[2]->HasSideEffects();
+}
+
+void TernaryOperator::OptimizeOperands(Optimizer& optimizer)
+{
+    optimizer.Optimize(Operands[0]);
+    // Selected operand passes 'this' for a function call.
+    optimizer.Optimize(Operands[1], false);
+    optimizer.Optimize(Operands[2], false);
+}
+
+unique_ptr<Expression> TernaryOperator::Simplify(Optimizer& optimizer, bool valueOnly)
+{
+    if(const Value* condVal = Operands[0]->GetConstantValue(); condVal && valueOnly)
+        return std::move(Operands[condVal->IsTrue() ? 1 : 2]);
+    return {};
+}
+
+bool TernaryOperator::AppendKey(string& out) const
 {
-    return Operands[0]->Evaluate(ctx, nullptr).IsTrue() ? Operands[1]->Evaluate(ctx, outThis) : Operands[2]->Evaluate(ctx, outThis);
+    out += "?(";
+    for(size_t i = 0; i < 3; ++i)
+    {
+        if(i > 0)
+            out += ',';
+        if(!Operands[i]->AppendKey(out))
+            return false;
+    }
+    out += ')';
+    return true;
+}
+
+void TernaryOperator::CollectEffects(Effects& effects) const
+{
+    for(const auto& operand : Operands)
+        operand->CollectEffects(effects);
 }
 
 void CallOperator::DebugPrint(uint32_t indentLevel, const string_view& prefix) const
 {
-    printf(DEBUG_PRINT_FORMAT_STR_BEG "CallOperator\n", DEBUG_PRINT_ARGS_BEG);
+    printf(DEBUG_PRINT_FORMAT_STR_BEG "CallOperator%s\n", DEBUG_PRINT_ARGS_BEG, IsTailCall ? " (tail call)" : "");
     ++indentLevel;
     Operands[0]->DebugPrint(indentLevel, "Callee: ");
     for(size_t i = 1, count = Operands.size(); i < count; ++i)
@@ -2628,7 +3728,8 @@ Value CallOperator::Evaluate(ExecuteContext& ctx, ThisType* outThis) const
     ThisType th = ThisType{};
     Value callee = Operands[0]->Evaluate(ctx, &th);
     const size_t argCount = Operands.size() - 1;
-    vector<Value> arguments(argCount);
+    ExecuteContext::ArgumentWindow argumentWindow{ctx, argCount};
+    const ValueSpan arguments = argumentWindow.GetSpan();
     for(size_t i = 0; i < argCount; ++i)
         arguments[i] = Operands[i + 1]->Evaluate(ctx, nullptr);
 
@@ -2645,45 +3746,29 @@ Value CallOperator::Evaluate(ExecuteContext& ctx, ThisType* outThis) const
 
     if(callee.GetType() == ValueType::Function)
     {
-        const AST::FunctionDefinition* const funcDef = callee.GetFunction();
-        MINSL_EXECUTION_CHECK( argCount == funcDef->Parameters.size(), GetPlace(), ERROR_MESSAGE_INVALID_NUMBER_OF_ARGUMENTS );
-        Object localScope;
-        // Setup parameters
-        for(size_t argIndex = 0; argIndex != argCount; ++argIndex)
-            localScope.GetOrCreateValue(funcDef->Parameters[argIndex]) = std::move(arguments[argIndex]);
-        ExecuteContext::LocalScopePush localContextPush{ctx, &localScope, std::move(th), GetPlace()};
-        try
-        {
-            callee.GetFunction()->Body.Execute(ctx);
-        }
-        catch(ReturnException& returnEx)
-        {
-            return std::move(returnEx.ThrownValue);
-        }
-        catch(BreakException)
+        if(IsTailCall)
         {
-            MINSL_EXECUTION_FAIL(GetPlace(), ERROR_MESSAGE_BREAK_WITHOUT_LOOP);
+            ctx.TailCallArguments.assign(std::make_move_iterator(arguments.begin()), std::make_move_iterator(arguments.end()));
+            throw TailCallException{GetPlace(), callee.GetFunction(), std::move(th)};
         }
-        catch(ContinueException)
-        {
-            MINSL_EXECUTION_FAIL(GetPlace(), ERROR_MESSAGE_CONTINUE_WITHOUT_LOOP);
-        }
-        return {};
+        return CallFunction(ctx, callee.GetFunction(), std::move(th), arguments);
     }
     if(callee.GetType() == ValueType::HostFunction)
-        return callee.GetHostFunction()(ctx.Env.GetOwner(), GetPlace(), std::move(arguments));
+        return callee.GetHostFunction()(ctx.Env.GetOwner(), GetPlace(), arguments);
     if(callee.GetType() == ValueType::SystemFunction)
     {
         switch(callee.GetSystemFunction())
         {
-        case SystemFunction::TypeOf: return BuiltInFunction_typeOf(ctx, GetPlace(), std::move(arguments));
-        case SystemFunction::Print: return BuiltInFunction_print(ctx, GetPlace(), std::move(arguments));
-        case SystemFunction::Min: return BuiltInFunction_min(ctx, GetPlace(), std::move(arguments));
-        case SystemFunction::Max: return BuiltInFunction_max(ctx, GetPlace(), std::move(arguments));
-        case SystemFunction::String_resize: return BuiltInFunction_String_resize(ctx, GetPlace(), th, std::move(arguments));
-        case SystemFunction::Array_add: return BuiltInFunction_Array_add(ctx, GetPlace(), th, std::move(arguments));
-        case SystemFunction::Array_insert: return BuiltInFunction_Array_insert(ctx, GetPlace(), th, std::move(arguments));
-        case SystemFunction::Array_remove: return BuiltInFunction_Array_remove(ctx, GetPlace(), th, std::move(arguments));
+        case SystemFunction::TypeOf: return BuiltInFunction_typeOf(ctx, GetPlace(), arguments);
+        case SystemFunction::Print: return BuiltInFunction_print(ctx, GetPlace(), arguments);
+        case SystemFunction::Min: return BuiltInFunction_min(ctx, GetPlace(), arguments);
+        case SystemFunction::Max: return BuiltInFunction_max(ctx, GetPlace(), arguments);
+        case SystemFunction::String_resize: return BuiltInFunction_String_resize(ctx, GetPlace(), th, arguments);
+        case SystemFunction::Array_add: return BuiltInFunction_Array_add(ctx, GetPlace(), th, arguments);
+        case SystemFunction::Array_insert: return BuiltInFunction_Array_insert(ctx, GetPlace(), th, arguments);
+        case SystemFunction::Array_remove: return BuiltInFunction_Array_remove(ctx, GetPlace(), th, arguments);
+        case SystemFunction::StringBuilder_append: return BuiltInFunction_StringBuilder_append(ctx, GetPlace(), th, arguments);
+        case SystemFunction::StringBuilder_toString: return BuiltInFunction_StringBuilder_toString(ctx, GetPlace(), th, arguments);
         default: assert(0); return {};
         }
     }
@@ -2691,15 +3776,16 @@ Value CallOperator::Evaluate(ExecuteContext& ctx, ThisType* outThis) const
     {
         switch(callee.GetTypeValue())
         {
-        case ValueType::Null: return BuiltInTypeCtor_Null(ctx, GetPlace(), std::move(arguments));
-        case ValueType::Number: return BuiltInTypeCtor_Number(ctx, GetPlace(), std::move(arguments));
-        case ValueType::String: return BuiltInTypeCtor_String(ctx, GetPlace(), std::move(arguments));
-        case ValueType::Object: return BuiltInTypeCtor_Object(ctx, GetPlace(), std::move(arguments));
-        case ValueType::Array: return BuiltInTypeCtor_Array(ctx, GetPlace(), std::move(arguments));
-        case ValueType::Type: return BuiltInTypeCtor_Type(ctx, GetPlace(), std::move(arguments));
+        case ValueType::Null: return BuiltInTypeCtor_Null(ctx, GetPlace(), arguments);
+        case ValueType::Number: return BuiltInTypeCtor_Number(ctx, GetPlace(), arguments);
+        case ValueType::String: return BuiltInTypeCtor_String(ctx, GetPlace(), arguments);
+        case ValueType::Object: return BuiltInTypeCtor_Object(ctx, GetPlace(), arguments);
+        case ValueType::Array: return BuiltInTypeCtor_Array(ctx, GetPlace(), arguments);
+        case ValueType::StringBuilder: return BuiltInTypeCtor_StringBuilder(ctx, GetPlace(), arguments);
+        case ValueType::Type: return BuiltInTypeCtor_Type(ctx, GetPlace(), arguments);
         case ValueType::Function:
         case ValueType::SystemFunction:
-            return BuiltInTypeCtor_Function(ctx, GetPlace(), std::move(arguments));
+            return BuiltInTypeCtor_Function(ctx, GetPlace(), arguments);
         default: assert(0); return {};
         }
     }
@@ -2707,6 +3793,62 @@ Value CallOperator::Evaluate(ExecuteContext& ctx, ThisType* outThis) const
     MINSL_EXECUTION_FAIL(GetPlace(), ERROR_MESSAGE_INVALID_FUNCTION);
 }
 
+void CallOperator::OptimizeOperands(Optimizer& optimizer)
+{
+    // Callee can provide 'this'.
+    optimizer.Optimize(Operands[0], false);
+    for(size_t i = 1, count = Operands.size(); i < count; ++i)
+        optimizer.Optimize(Operands[i]);
+}
+
+void CallOperator::CollectEffects(Effects& effects) const
+{
+    effects.HasCalls = true;
+    for(const auto& operand : Operands)
+        operand->CollectEffects(effects);
+}
+
+Value CallOperator::CallFunction(ExecuteContext& ctx, const FunctionDefinition* funcDef, ThisType&& th, ValueSpan arguments) const
+{
+    MINSL_EXECUTION_CHECK( arguments.size() == funcDef->Parameters.size(), GetPlace(), ERROR_MESSAGE_INVALID_NUMBER_OF_ARGUMENTS );
+    ExecuteContext::LocalScopePush localContextPush{ctx, std::move(th), GetPlace()};
+    // Setup parameters
+    Object& localScope = *ctx.GetCurrentLocalScope();
+    for(size_t argIndex = 0, argCount = arguments.size(); argIndex != argCount; ++argIndex)
+        ctx.CreateLocalVariable(localScope, funcDef->Parameters[argIndex], std::move(arguments[argIndex]));
+    for(;;)
+    {
+        try
+        {
+            funcDef->Body.Execute(ctx);
+            return {};
+        }
+        catch(ReturnException& returnEx)
+        {
+            return std::move(returnEx.ThrownValue);
+        }
+        catch(TailCallException& tailCall)
+        {
+            // Reuse this frame for the call in tail position, so tail recursion runs in constant stack space.
+            funcDef = tailCall.Function;
+            vector<Value>& tailCallArgs = ctx.TailCallArguments;
+            MINSL_EXECUTION_CHECK( tailCallArgs.size() == funcDef->Parameters.size(), tailCall.Place, ERROR_MESSAGE_INVALID_NUMBER_OF_ARGUMENTS );
+            ctx.ResetCurrentLocalScope(std::move(tailCall.This));
+            for(size_t argIndex = 0, argCount = tailCallArgs.size(); argIndex != argCount; ++argIndex)
+                ctx.CreateLocalVariable(localScope, funcDef->Parameters[argIndex], std::move(tailCallArgs[argIndex]));
+            tailCallArgs.clear();
+        }
+        catch(BreakException)
+        {
+            MINSL_EXECUTION_FAIL(GetPlace(), ERROR_MESSAGE_BREAK_WITHOUT_LOOP);
+        }
+        catch(ContinueException)
+        {
+            MINSL_EXECUTION_FAIL(GetPlace(), ERROR_MESSAGE_CONTINUE_WITHOUT_LOOP);
+        }
+    }
+}
+
 void FunctionDefinition::DebugPrint(uint32_t indentLevel, const string_view& prefix) const
 {
     printf(DEBUG_PRINT_FORMAT_STR_BEG "Function(", DEBUG_PRINT_ARGS_BEG);
@@ -2720,6 +3862,11 @@ void FunctionDefinition::DebugPrint(uint32_t indentLevel, const string_view& pre
     Body.DebugPrint(indentLevel + 1, "Body: ");
 }
 
+void FunctionDefinition::OptimizeOperands(Optimizer& optimizer)
+{
+    optimizer.OptimizeFunctionBody(Body);
+}
+
 bool FunctionDefinition::AreParameterNamesUnique() const
 {
     // Warning! O(n^2) algorithm.
@@ -2761,6 +3908,22 @@ Value ObjectExpression::Evaluate(ExecuteContext& ctx, ThisType* outThis) const
     return Value{std::move(obj)};
 }
 
+void ObjectExpression::OptimizeOperands(Optimizer& optimizer)
+{
+    optimizer.Optimize(BaseExpression);
+    for(auto& [name, valueExpr] : Items)
+        optimizer.Optimize(valueExpr);
+}
+
+void ObjectExpression::CollectEffects(Effects& effects) const
+{
+    effects.CreatesObjects = true;
+    if(BaseExpression)
+        BaseExpression->CollectEffects(effects);
+    for(const auto& [name, valueExpr] : Items)
+        valueExpr->CollectEffects(effects);
+}
+
 void ArrayExpression::DebugPrint(uint32_t indentLevel, const string_view& prefix) const
 {
     printf(DEBUG_PRINT_FORMAT_STR_BEG "Array\n", DEBUG_PRINT_ARGS_BEG);
@@ -2781,6 +3944,363 @@ Value ArrayExpression::Evaluate(ExecuteContext& ctx, ThisType* outThis) const
     return Value{std::move(result)};
 }
 
+void ArrayExpression::OptimizeOperands(Optimizer& optimizer)
+{
+    for(auto& item : Items)
+        optimizer.Optimize(item);
+}
+
+void ArrayExpression::CollectEffects(Effects& effects) const
+{
+    effects.CreatesObjects = true;
+    for(const auto& item : Items)
+        item->CollectEffects(effects);
+}
+
+void CachedExpression::DebugPrint(uint32_t indentLevel, const string_view& prefix) const
+{
+    printf(DEBUG_PRINT_FORMAT_STR_BEG "Cached in slot %zu\n", DEBUG_PRINT_ARGS_BEG, Slot);
+    Inner->DebugPrint(indentLevel + 1, "Inner: ");
+}
+
+const Value& CachedExpression::EvaluateRef(ExecuteContext& ctx, Value& outTemp, ThisType* outThis) const
+{
+    ExecuteContext::CachedValue& cached = ctx.CachedValues[Slot];
+    if(!cached.Valid)
+    {
+        cached.Val = Inner->Evaluate(ctx, nullptr);
+        cached.Valid = true;
+    }
+    return cached.Val;
+}
+
+void CountingForLoop::DebugPrint(uint32_t indentLevel, const string_view& prefix) const
+{
+    printf(DEBUG_PRINT_FORMAT_STR_BEG "Counting for, counter %s, step %g%s\n", DEBUG_PRINT_ARGS_BEG,
+        Counter->S.c_str(), Step, BoundIsInvariant ? ", invariant bound" : "");
+    Loop->DebugPrint(indentLevel + 1, "Loop: ");
+}
+
+void CountingForLoop::Execute(ExecuteContext& ctx) const
+{
+    if(Loop->InitExpression)
+        Loop->InitExpression->Execute(ctx);
+    Value* const counter = FindCounter(ctx);
+    double bound = 0.0;
+    if(!counter || (BoundIsInvariant && !EvaluateBound(ctx, bound)))
+    {
+        Loop->ExecuteIterations(ctx);
+        return;
+    }
+    for(;;)
+    {
+        // Loop continues as usual from the same point. Evaluating the condition again is fine as it has no side effects.
+        if(!BoundIsInvariant && !EvaluateBound(ctx, bound))
+        {
+            Loop->ExecuteIterations(ctx);
+            return;
+        }
+        if(!Compare(counter->GetNumber(), bound))
+            break;
+        try
+        {
+            Loop->Body->Execute(ctx);
+        }
+        catch(const BreakException&)
+        {
+            break;
+        }
+        catch(const ContinueException&)
+        {
+        }
+        counter->ChangeNumber(counter->GetNumber() + Step);
+    }
+}
+
+Value* CountingForLoop::FindCounter(ExecuteContext& ctx) const
+{
+    const LValue lval = Counter->GetLValue(ctx);
+    const ObjectMemberLValue& objMemberLval = std::get<ObjectMemberLValue>(lval);
+    Value* const val = objMemberLval.TryGetValue();
+    if(!val || val->GetType() != ValueType::Number)
+        return nullptr;
+    // Body doesn't assign the counter by name, but a member of 'this' can be modified through another reference,
+    // and a global variable by a called function - also removed, which would leave val dangling.
+    if(ctx.IsLocal() && objMemberLval.Obj == ctx.GetCurrentLocalScope())
+        return val;
+    if(objMemberLval.Obj == &ctx.GlobalScope && !BodyHasCalls)
+        return val;
+    return nullptr;
+}
+
+bool CountingForLoop::EvaluateBound(ExecuteContext& ctx, double& outBound) const
+{
+    Value temp;
+    const Value& val = Bound->EvaluateRef(ctx, temp, nullptr);
+    if(val.GetType() != ValueType::Number)
+        return false;
+    outBound = val.GetNumber();
+    return true;
+}
+
+bool CountingForLoop::Compare(double counter, double bound) const
+{
+    switch(Comparison)
+    {
+    case BinaryOperatorType::Less:         return counter <  bound;
+    case BinaryOperatorType::Greater:      return counter >  bound;
+    case BinaryOperatorType::LessEqual:    return counter <= bound;
+    case BinaryOperatorType::GreaterEqual: return counter >= bound;
+    default: assert(0); return false;
+    }
+}
+
+void Optimizer::Optimize(unique_ptr<Statement>& stmt)
+{
+    if(!stmt)
+        return;
+    if(dynamic_cast<const WhileLoop*>(stmt.get()) != nullptr ||
+        dynamic_cast<const ForLoop*>(stmt.get()) != nullptr ||
+        dynamic_cast<const RangeBasedForLoop*>(stmt.get()) != nullptr)
+    {
+        OptimizeLoop(stmt);
+        return;
+    }
+    if(unique_ptr<Statement> replacement = stmt->Optimize(*this))
+        stmt = std::move(replacement);
+    EliminateCommonSubexpressions(stmt);
+}
+
+void Optimizer::Optimize(unique_ptr<Expression>& expr, bool valueOnly)
+{
+    if(!expr)
+        return;
+    if(valueOnly && TryCache(expr))
+        return;
+    expr->OptimizeOperands(*this);
+    if(unique_ptr<Expression> replacement = expr->Simplify(*this, valueOnly))
+        expr = std::move(replacement);
+}
+
+void Optimizer::OptimizeFunctionBody(Block& body)
+{
+    // Already optimized before looking for common subexpressions of the statement that contains the definition.
+    if(m_CommonSubexpressions)
+        return;
+    // Loops around the definition don't execute the body.
+    vector<LoopCache> loops = std::move(m_Loops);
+    m_Loops.clear();
+    const bool inFunction = m_InFunction;
+    m_InFunction = true;
+    body.Optimize(*this);
+    m_InFunction = inFunction;
+    m_Loops = std::move(loops);
+}
+
+void Optimizer::OptimizeLoop(unique_ptr<Statement>& loop)
+{
+    LoopCache loopCache;
+    loop->CollectEffects(loopCache.LoopEffects);
+    // Nothing is invariant in a loop that calls functions. Its body is still optimized as usual.
+    const bool cacheable = !loopCache.LoopEffects.HasCalls;
+    if(cacheable)
+        m_Loops.push_back(std::move(loopCache));
+    if(unique_ptr<Statement> replacement = loop->Optimize(*this))
+        loop = std::move(replacement);
+    if(cacheable)
+    {
+        LoopCache& cache = m_Loops.back();
+        TrySpecializeCountingLoop(loop, cache.LoopEffects);
+        vector<size_t> slots = std::move(cache.Slots);
+        m_Loops.pop_back();
+        if(!slots.empty())
+            loop = make_unique<CacheScope>(std::move(loop), std::move(slots));
+    }
+    else
+        TrySpecializeCountingLoop(loop, loopCache.LoopEffects);
+}
+
+// Returns true if expression adds a constant number to the counter, like: ++i, i--, i += 2.
+static bool GetCountingStep(const Expression& iteration, const Identifier& counter, double& outStep)
+{
+    const auto isCounter = [&counter](const Expression* expr) -> bool {
+        const Identifier* const identifier = dynamic_cast<const Identifier*>(expr);
+        return identifier && identifier->Scope == counter.Scope && identifier->S == counter.S;
+    };
+    if(const UnaryOperator* const unaryOp = dynamic_cast<const UnaryOperator*>(&iteration); unaryOp && isCounter(unaryOp->Operand.get()))
+    {
+        switch(unaryOp->Type)
+        {
+        case UnaryOperatorType::Preincrementation:
+        case UnaryOperatorType::Postincrementation:
+            outStep = 1.0;
+            return true;
+        case UnaryOperatorType::Predecrementation:
+        case UnaryOperatorType::Postdecrementation:
+            outStep = -1.0;
+            return true;
+        default:
+            return false;
+        }
+    }
+    if(const BinaryOperator* const binaryOp = dynamic_cast<const BinaryOperator*>(&iteration);
+        binaryOp && (binaryOp->Type == BinaryOperatorType::AssignmentAdd || binaryOp->Type == BinaryOperatorType::AssignmentSub) &&
+        isCounter(binaryOp->Operands[0].get()))
+    {
+        const Value* const stepVal = binaryOp->Operands[1]->GetConstantValue();
+        if(!stepVal || stepVal->GetType() != ValueType::Number)
+            return false;
+        outStep = binaryOp->Type == BinaryOperatorType::AssignmentAdd ? stepVal->GetNumber() : -stepVal->GetNumber();
+        return true;
+    }
+    return false;
+}
+
+void Optimizer::TrySpecializeCountingLoop(unique_ptr<Statement>& loop, const Effects& loopEffects)
+{
+    ForLoop* const forLoop = dynamic_cast<ForLoop*>(loop.get());
+    if(!forLoop || !forLoop->ConditionExpression || !forLoop->IterationExpression)
+        return;
+    const BinaryOperator* const condition = dynamic_cast<const BinaryOperator*>(forLoop->ConditionExpression.get());
+    if(!condition ||
+        (condition->Type != BinaryOperatorType::Less && condition->Type != BinaryOperatorType::Greater &&
+        condition->Type != BinaryOperatorType::LessEqual && condition->Type != BinaryOperatorType::GreaterEqual))
+        return;
+    const Identifier* const counter = dynamic_cast<const Identifier*>(condition->Operands[0].get());
+    const Expression* const bound = condition->Operands[1].get();
+    double step = 0.0;
+    if(!counter || bound->HasSideEffects() || !GetCountingStep(*forLoop->IterationExpression, *counter, step))
+        return;
+    // Counter written by the body in any way - not only by the iteration expression - is left to the generic loop.
+    Effects bodyEffects;
+    forLoop->Body->CollectEffects(bodyEffects);
+    if(bodyEffects.WrittenVariables.count(counter->S) > 0)
+        return;
+    Effects boundEffects;
+    bound->CollectEffects(boundEffects);
+
+    const BinaryOperatorType comparison = condition->Type;
+    auto countingLoop = make_unique<CountingForLoop>(
+        unique_ptr<ForLoop>{static_cast<ForLoop*>(loop.release())}, counter, comparison, step);
+    countingLoop->BoundIsInvariant = !loopEffects.HasCalls && IsInvariant(boundEffects, loopEffects);
+    countingLoop->BodyHasCalls = bodyEffects.HasCalls;
+    loop = std::move(countingLoop);
+}
+
+void Optimizer::EliminateCommonSubexpressions(unique_ptr<Statement>& stmt)
+{
+    // Only assignment is supported, where all operands are evaluated before its only write.
+    BinaryOperator* const assignment = dynamic_cast<BinaryOperator*>(stmt.get());
+    if(assignment == nullptr || !assignment->IsAssignment())
+        return;
+    Effects effects;
+    assignment->Operands[0]->CollectEffects(effects);
+    assignment->Operands[1]->CollectEffects(effects);
+    if(effects.HasCalls || effects.WritesMembers || !effects.WrittenVariables.empty())
+        return;
+
+    CommonSubexpressions commonSubexpressions;
+    m_CommonSubexpressions = &commonSubexpressions;
+    assignment->OptimizeOperands(*this);
+    commonSubexpressions.Counting = false;
+    assignment->OptimizeOperands(*this);
+    m_CommonSubexpressions = nullptr;
+
+    if(commonSubexpressions.Slots.empty())
+        return;
+    vector<size_t> slots;
+    for(const auto& [key, slot] : commonSubexpressions.Slots)
+        slots.push_back(slot);
+    std::sort(slots.begin(), slots.end());
+    stmt = make_unique<CacheScope>(std::move(stmt), std::move(slots));
+}
+
+bool Optimizer::TryCache(unique_ptr<Expression>& expr)
+{
+    if(m_Loops.empty() && !m_CommonSubexpressions)
+        return false;
+    // Not worth caching.
+    if(dynamic_cast<const ConstantExpression*>(expr.get()) != nullptr)
+        return false;
+    string key;
+    if(!expr->AppendKey(key))
+        return false;
+
+    if(m_CommonSubexpressions)
+    {
+        if(m_CommonSubexpressions->Counting)
+        {
+            ++m_CommonSubexpressions->Counts[key];
+            return false;
+        }
+        if(m_CommonSubexpressions->Counts[key] < 2)
+            return false;
+        const auto [slotIt, inserted] = m_CommonSubexpressions->Slots.try_emplace(std::move(key), m_NextCacheSlot);
+        if(inserted)
+            ++m_NextCacheSlot;
+        expr = make_unique<CachedExpression>(std::move(expr), slotIt->second);
+        return true;
+    }
+
+    Effects exprEffects;
+    expr->CollectEffects(exprEffects);
+    // Outermost loop first, so the value is reused for as long as possible.
+    for(size_t loopIndex = 0, loopCount = m_Loops.size(); loopIndex < loopCount; ++loopIndex)
+    {
+        if(!IsInvariant(exprEffects, m_Loops[loopIndex].LoopEffects))
+            continue;
+        // Parts of the expression don't need to be cached separately.
+        vector<LoopCache> loops = std::move(m_Loops);
+        m_Loops.clear();
+        expr->OptimizeOperands(*this);
+        if(unique_ptr<Expression> replacement = expr->Simplify(*this, true))
+            expr = std::move(replacement);
+        m_Loops = std::move(loops);
+        if(dynamic_cast<const ConstantExpression*>(expr.get()) == nullptr)
+        {
+            m_Loops[loopIndex].Slots.push_back(m_NextCacheSlot);
+            expr = make_unique<CachedExpression>(std::move(expr), m_NextCacheSlot++);
+        }
+        return true;
+    }
+    return false;
+}
+
+bool Optimizer::IsInvariant(const Effects& exprEffects, const Effects& loopEffects) const
+{
+    if(exprEffects.ReadsMembers && loopEffects.WritesMembers)
+        return false;
+    for(const string& name : exprEffects.ReadVariables)
+    {
+        if(loopEffects.WrittenVariables.count(name) > 0)
+            return false;
+    }
+    // Inside a function, variable can be a member of 'this', which can also be accessed through another variable.
+    if(m_InFunction)
+    {
+        if(!exprEffects.ReadVariables.empty() && loopEffects.WritesMembers)
+            return false;
+        if(exprEffects.ReadsMembers && !loopEffects.WrittenVariables.empty())
+            return false;
+    }
+    return true;
+}
+
+unique_ptr<Expression> Optimizer::TryFold(const Expression& expr)
+{
+    try
+    {
+        Value val = expr.Evaluate(m_Context, nullptr);
+        const ValueType type = val.GetType();
+        if(type == ValueType::Null || type == ValueType::Number || type == ValueType::String)
+            return std::make_unique<ConstantValue>(expr.GetPlace(), std::move(val));
+    }
+    catch(const ExecutionError&)
+    {
+    }
+    return {};
+}
+
 } // namespace AST
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -2862,7 +4382,13 @@ void Parser::ParseFunctionDefinition(AST::FunctionDefinition& funcDef)
     MUST_PARSE( funcDef.AreParameterNamesUnique(), ERROR_MESSAGE_PARAMETER_NAMES_MUST_BE_UNIQUE );
     MUST_PARSE( TryParseSymbol(Symbol::RoundBracketClose), ERROR_MESSAGE_EXPECTED_SYMBOL_ROUND_BRACKET_CLOSE );
     MUST_PARSE( TryParseSymbol(Symbol::CurlyBracketOpen), ERROR_MESSAGE_EXPECTED_SYMBOL_CURLY_BRACKET_OPEN );
+    const bool prevInFunction = m_InFunction;
+    const uint32_t prevTryDepth = m_TryDepth;
+    m_InFunction = true;
+    m_TryDepth = 0;
     ParseBlock(funcDef.Body);
+    m_InFunction = prevInFunction;
+    m_TryDepth = prevTryDepth;
     MUST_PARSE( TryParseSymbol(Symbol::CurlyBracketClose), ERROR_MESSAGE_EXPECTED_SYMBOL_CURLY_BRACKET_CLOSE );
 }
 
@@ -2996,6 +4522,10 @@ unique_ptr<AST::Statement> Parser::TryParseStatement()
         auto stmt = std::make_unique<AST::ReturnStatement>(place);
         stmt->ReturnedValue = TryParseExpr17();
         MUST_PARSE( TryParseSymbol(Symbol::Semicolon), ERROR_MESSAGE_EXPECTED_SYMBOL_SEMICOLON );
+        // Not inside try, because catch and finally must still see what happens in the called function.
+        if(m_InFunction && m_TryDepth == 0)
+            if(AST::CallOperator* callOp = dynamic_cast<AST::CallOperator*>(stmt->ReturnedValue.get()); callOp)
+                callOp->IsTailCall = true;
         return stmt;
     }
 
@@ -3042,6 +4572,7 @@ unique_ptr<AST::Statement> Parser::TryParseStatement()
     if(TryParseSymbol(Symbol::Try))
     {
         auto stmt = std::make_unique<AST::TryStatement>(place);
+        ++m_TryDepth;
         MUST_PARSE(stmt->TryBlock = TryParseStatement(), ERROR_MESSAGE_EXPECTED_STATEMENT);
         if(TryParseSymbol(Symbol::Finally))
             MUST_PARSE(stmt->FinallyBlock = TryParseStatement(), ERROR_MESSAGE_EXPECTED_STATEMENT);
@@ -3055,6 +4586,7 @@ unique_ptr<AST::Statement> Parser::TryParseStatement()
             if(TryParseSymbol(Symbol::Finally))
                 MUST_PARSE(stmt->FinallyBlock = TryParseStatement(), ERROR_MESSAGE_EXPECTED_STATEMENT);
         }
+        --m_TryDepth;
         return stmt;
     }
 
@@ -3643,6 +5175,101 @@ string Parser::TryParseIdentifier()
     return {};
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// class ExecutionStack implementation
+
+#ifdef _WIN32
+
+ExecutionStack::ExecutionStack(size_t size) : m_Size{size} { }
+ExecutionStack::~ExecutionStack() { }
+
+void ExecutionStack::Run(void (*func)(void*), void* userData)
+{
+    assert(!m_Running);
+    RunData data{this, func, userData};
+    const bool wasFiber = IsThreadAFiber() != FALSE;
+    data.CallerFiber = wasFiber ? GetCurrentFiber() : ConvertThreadToFiber(nullptr);
+    if(!data.CallerFiber)
+        throw std::bad_alloc{};
+    void* const fiber = CreateFiberEx(0, m_Size, FIBER_FLAG_FLOAT_SWITCH, FiberEntry, &data);
+    if(fiber)
+    {
+        SwitchToFiber(fiber);
+        DeleteFiber(fiber);
+    }
+    if(!wasFiber)
+        ConvertFiberToThread();
+    if(!fiber)
+        throw std::bad_alloc{};
+    if(data.Exception)
+        std::rethrow_exception(data.Exception);
+}
+
+void WINAPI ExecutionStack::FiberEntry(void* param)
+{
+    RunData& data = *(RunData*)param;
+    RunOnStack(data);
+    // Fiber function must never return.
+    SwitchToFiber(data.CallerFiber);
+}
+
+#else // #ifdef _WIN32
+
+ExecutionStack::ExecutionStack(size_t size) : m_Size{size}
+{
+    m_Memory = mmap(nullptr, m_Size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(m_Memory == MAP_FAILED)
+        throw std::bad_alloc{};
+}
+
+ExecutionStack::~ExecutionStack()
+{
+    munmap(m_Memory, m_Size);
+}
+
+void ExecutionStack::Run(void (*func)(void*), void* userData)
+{
+    assert(!m_Running);
+    RunData data{this, func, userData};
+    ucontext_t context;
+    getcontext(&context);
+    context.uc_stack.ss_sp = m_Memory;
+    context.uc_stack.ss_size = m_Size;
+    context.uc_link = &data.CallerContext;
+    // makecontext passes only int arguments.
+    const uint64_t dataPtr = (uint64_t)(uintptr_t)&data;
+    makecontext(&context, (void(*)())ContextEntry, 2, (unsigned int)(dataPtr >> 32), (unsigned int)dataPtr);
+    swapcontext(&data.CallerContext, &context);
+    if(data.Exception)
+        std::rethrow_exception(data.Exception);
+}
+
+void ExecutionStack::ContextEntry(unsigned int dataPtrHi, unsigned int dataPtrLo)
+{
+    RunData& data = *(RunData*)(uintptr_t)(((uint64_t)dataPtrHi << 32) | dataPtrLo);
+    RunOnStack(data);
+    // Returning resumes uc_link.
+}
+
+#endif // #ifdef _WIN32
+
+void ExecutionStack::RunOnStack(RunData& data)
+{
+    ExecutionStack& stack = *data.Stack;
+    const char stackMarker = 0;
+    stack.m_Limit = (uintptr_t)&stackMarker - stack.m_Size + EXECUTION_STACK_SAFETY_MARGIN;
+    stack.m_Running = true;
+    try
+    {
+        data.Func(data.UserData);
+    }
+    catch(...)
+    {
+        data.Exception = std::current_exception();
+    }
+    stack.m_Running = false;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // class EnvironmentPimpl implementation
 
@@ -3654,17 +5281,42 @@ Value EnvironmentPimpl::Execute(const string_view& code)
         Parser parser{tokenizer};
         parser.ParseScript(script);
     }
+    if(m_OptimizationEnabled)
+    {
+        AST::Optimizer optimizer{*this};
+        script.Optimize(optimizer);
+    }
+
+    ExecuteScriptData data{this, &script};
+    // Nested call from a host function is already running on the execution stack.
+    if(m_ExecutionStack && m_ExecutionStack->IsRunning())
+        ExecuteScript(&data);
+    else
+    {
+        const size_t stackSize = m_MaxCallDepth * EXECUTION_STACK_SIZE_PER_CALL + EXECUTION_STACK_SAFETY_MARGIN * 2;
+        if(!m_ExecutionStack || m_ExecutionStack->GetSize() != stackSize)
+        {
+            m_ExecutionStack.reset();
+            m_ExecutionStack = std::make_unique<ExecutionStack>(stackSize);
+        }
+        m_ExecutionStack->Run(ExecuteScript, &data);
+    }
+    return std::move(data.Result);
+}
 
+void EnvironmentPimpl::ExecuteScript(void* data)
+{
+    ExecuteScriptData& scriptData = *(ExecuteScriptData*)data;
+    EnvironmentPimpl& env = *scriptData.Env;
     try
     {
-        AST::ExecuteContext executeContext{*this, m_GlobalScope};
-        script.Execute(executeContext);
+        AST::ExecuteContext executeContext{env, env.m_GlobalScope, env.m_MaxCallDepth, env.m_ExecutionStack->GetLimit()};
+        scriptData.Script->Execute(executeContext);
     }
     catch(ReturnException& returnEx)
     {
-        return std::move(returnEx.ThrownValue);
+        scriptData.Result = std::move(returnEx.ThrownValue);
     }
-    return {};
 }
 
 string_view EnvironmentPimpl::GetTypeName(ValueType type) const
@@ -3681,6 +5333,10 @@ Environment::~Environment() { delete pimpl; }
 Value Environment::Execute(const string_view& code) { return pimpl->Execute(code); }
 const std::string& Environment::GetOutput() const { return pimpl->GetOutput(); }
 std::string_view Environment::GetTypeName(ValueType type) const { return pimpl->GetTypeName(type); }
+void Environment::SetMaxCallDepth(size_t maxCallDepth) { pimpl->SetMaxCallDepth(maxCallDepth); }
+size_t Environment::GetMaxCallDepth() const { return pimpl->GetMaxCallDepth(); }
+void Environment::SetOptimizationEnabled(bool enabled) { pimpl->SetOptimizationEnabled(enabled); }
+bool Environment::IsOptimizationEnabled() const { return pimpl->IsOptimizationEnabled(); }
 
 } // namespace MinScriptLang
 
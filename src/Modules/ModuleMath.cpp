@@ -37,7 +37,7 @@ namespace ModuleMath
 
 using namespace MinScriptLang;
 
-static Value Func_abs(Environment& env, const PlaceInCode& place, std::vector<Value>&& args)
+static Value Func_abs(Environment& env, const PlaceInCode& place, ValueSpan args)
 {
     MINSL_LOAD_ARGS_1_NUMBER("math.abs", arg);
     return Value{abs(arg)};
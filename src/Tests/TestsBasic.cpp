@@ -928,6 +928,33 @@ TEST_CASE("Basic")
         env.Execute(code);
         REQUIRE(env.GetOutput() == "1\n3\n");
     }
+    SECTION("Side effects invalidating borrowed operand")
+    {
+        const char* code = "s='A'; t=s + (s='B'); \n"
+            "a=['X', 'Y']; u=a[0] + (a=['Z'])[0]; \n"
+            "o={m:'M'}; v=o.m + (o={m:'N'}).m; \n"
+            "function f() { a = 1; return 0; } \n"
+            "a=[10, 20]; w=a[f()]; \n"
+            "print(t, u, v, w, s, a); \n";
+        env.Execute(code);
+        REQUIRE(env.GetOutput() == "AB\nXZ\nMN\n10\nB\n1\n");
+    }
+    SECTION("Borrowed reads of object members and array items")
+    {
+        const char* code = "o={s:'ABC', arr:[{x:1}, {x:'Q'}]}; i=1; \n"
+            "print(o.s.count, o.arr[i].x, o.arr[0].x == 1, ({p:'P'}).p, [4, 5][1], (i ? o : null).s); \n";
+        env.Execute(code);
+        REQUIRE(env.GetOutput() == "3\nQ\n1\nP\n5\nABC\n");
+    }
+    SECTION("Assignment to members with computed keys")
+    {
+        const char* code = "o={}; k='a'; o[k + 'b']=1; o['a' + 'b'] += 2; o[k + 'b'] *= 10; \n"
+            "n=0; for(i=0; i<3; ++i) { n += 1; o[String(k)] = n; } \n"
+            "o[k] = null; \n"
+            "print(o.ab, n, o.count); \n";
+        env.Execute(code);
+        REQUIRE(env.GetOutput() == "30\n3\n1\n");
+    }
     SECTION("Side effects breaking string lvalue crashing the host")
     {
         const char* code = "globalArr = ['AAA', 'BBB', 'CCC']; \n"
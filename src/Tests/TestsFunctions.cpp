@@ -92,6 +92,53 @@ TEST_CASE("Functions")
         env.Execute(code);
         REQUIRE(env.GetOutput() == "1\n6\n24\n");
     }
+    SECTION("Deep recursion")
+    {
+        const char* code = "function sum(n) { if(n == 0) return 0; return n + sum(n - 1); } \n"
+            "print(sum(5000) == 12502500); \n";
+        env.Execute(code);
+        REQUIRE(env.GetOutput() == "1\n");
+    }
+    SECTION("Deep recursion with increased max call depth")
+    {
+        env.SetMaxCallDepth(1000000);
+        REQUIRE(env.GetMaxCallDepth() == 1000000);
+        const char* code = "function sum(n) { if(n == 0) return 0; return n + sum(n - 1); } \n"
+            "print(sum(200000) == 20000100000); \n";
+        env.Execute(code);
+        REQUIRE(env.GetOutput() == "1\n");
+    }
+    SECTION("Tail calls")
+    {
+        env.SetMaxCallDepth(100);
+        const char* code = "function loop(n, acc) { if(n == 0) return acc; return loop(n - 1, acc + 2); } \n"
+            "function isEven(n) { if(n == 0) return 1; return isOdd(n - 1); } \n"
+            "function isOdd(n) { if(n == 0) return 0; return isEven(n - 1); } \n"
+            "obj = { n: 0, count: function(k) { if(k == 0) return this.n; ++this.n; return this.count(k - 1); } }; \n"
+            "print(loop(100000, 0), isEven(10001), obj.count(1000), obj.n); \n";
+        env.Execute(code);
+        REQUIRE(env.GetOutput() == "200000\n0\n1000\n1000\n");
+    }
+    SECTION("No tail calls inside try")
+    {
+        env.SetMaxCallDepth(100);
+        const char* code = "function f(n) { try { if(n == 0) return 0; return f(n - 1); } catch(ex) { throw ex; } } \n"
+            "try f(1000); catch(ex) print(ex.message); \n"
+            "function g(n) { if(n == 0) throw 'E'; return g(n - 1); } \n"
+            "function h() { try { return g(1000); } catch(ex) { return ex; } } \n"
+            "print(h()); \n";
+        env.Execute(code);
+        REQUIRE(env.GetOutput() == "Stack overflow.\nE\n");
+    }
+    SECTION("Max call depth")
+    {
+        env.SetMaxCallDepth(10);
+        const char* code = "function f(n) { if(n > 0) f(n - 1); } \n"
+            "f(9); print('OK'); \n"
+            "try f(10); catch(ex) print(ex.message); \n";
+        env.Execute(code);
+        REQUIRE(env.GetOutput() == "OK\nStack overflow.\n");
+    }
     SECTION("Break without loop in function")
     {
         const char* code = "function Bad() { break; } \n"
@@ -131,4 +178,17 @@ TEST_CASE("Functions")
         const char* code = "function f(a, b, c, d) { print(a, b, c, d); } f('1', '2', '3' ,'4', '5');";
         REQUIRE_THROWS_AS( env.Execute(code), ExecutionError );
     }
+    SECTION("Deep recursion with many arguments")
+    {
+        const char* code = "function f(n, a, b, c, d, e) { \n"
+            "  if(n == 0) return a + b + c + d + e; \n"
+            "  local.x = f(n - 1, a, b, c, d, e + 1); \n"
+            "  return x + min(n, 1); \n"
+            "} \n"
+            "print(f(90, 1, 2, 3, 4, 0)); print(f(3, 0, 0, 0, 0, 0)); \n"
+            "try f(20000, 1, 2, 3, 4, 5); catch(ex) print('overflow'); \n"
+            "print(f(2, 'A', 'B', 'C', 'D', 1) == null); \n";
+        REQUIRE_THROWS_AS( env.Execute(code), ExecutionError );
+        REQUIRE(env.GetOutput() == "190\n6\noverflow\n");
+    }
 }
@@ -0,0 +1,219 @@
+/*
+MinScriptLang - minimalistic scripting language
+
+Version: 0.0.1-development, 2021-11
+Homepage: https://github.com/sawickiap/MinScriptLang
+Author: Adam Sawicki, adam__REMOVE_THIS__@asawicki.info, https://asawicki.info
+
+================================================================================
+MIT License
+
+Copyright (c) 2019-2021 Adam Sawicki
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "PCH.hpp"
+#include "../MinScriptLang.hpp"
+#include "../3rdParty/Catch2/catch.hpp"
+
+using namespace MinScriptLang;
+
+
+// Executes code with optimization enabled and disabled and returns output followed by error message, if any.
+static std::string ExecuteWithOptimization(const char* code, bool optimizationEnabled)
+{
+    Environment env;
+    env.SetOptimizationEnabled(optimizationEnabled);
+    try
+    {
+        env.Execute(code);
+        return env.GetOutput();
+    }
+    catch(const Error& err)
+    {
+        return env.GetOutput() + "Error: " + err.what();
+    }
+}
+
+static void RequireSameWithoutOptimization(const char* code)
+{
+    REQUIRE(ExecuteWithOptimization(code, true) == ExecuteWithOptimization(code, false));
+}
+
+TEST_CASE("Optimizer")
+{
+    SECTION("Enabled by default")
+    {
+        Environment env;
+        REQUIRE(env.IsOptimizationEnabled());
+        env.SetOptimizationEnabled(false);
+        REQUIRE(!env.IsOptimizationEnabled());
+        env.Execute("print(1 + 2);");
+        REQUIRE(env.GetOutput() == "3\n");
+    }
+    SECTION("Constant folding")
+    {
+        const char* code = "print(60*60*24, 'a' + 'b' + 'c', -(2+3), !0, ~0, 10 % 3, 1 << 4, 2 < 3); \n"
+            "print('abc'[1], 'abc'.count, 1 < 2 ? 'yes' : 'no', (1, 2), null == null); \n"
+            "s = 'x' + 'y'; s[0] = 'z'; print(s, 'x' + 'y'); \n";
+        REQUIRE(ExecuteWithOptimization(code, true) == "86400\nabc\n-5\n1\n-1\n1\n16\n1\n"
+            "b\n3\nyes\n2\n1\n"
+            "zy\nxy\n");
+        RequireSameWithoutOptimization(code);
+    }
+    SECTION("Folding mixed with variables")
+    {
+        const char* code = "a = 10; print(a * (2 + 3), (1 + 2) * a, a + 'x'.count, 0 ? a : -a); \n"
+            "arr = [1 + 1, 2 * 2]; obj = {x: 'a' + 'b'}; print(arr[0], arr[1], obj.x); \n";
+        REQUIRE(ExecuteWithOptimization(code, true) == "50\n30\n11\n-10\n2\n4\nab\n");
+        RequireSameWithoutOptimization(code);
+    }
+    SECTION("Short circuit with constant operand")
+    {
+        const char* code = "function f() { print('called'); return 'f'; } \n"
+            "print(0 && f(), 1 && f(), 0 || f(), 'a' || f(), 1 && 0 || 'b'); \n";
+        REQUIRE(ExecuteWithOptimization(code, true) == "called\ncalled\n0\nf\nf\na\nb\n");
+        RequireSameWithoutOptimization(code);
+    }
+    SECTION("Dead branches")
+    {
+        const char* code = "if(0) print('A'); else print('B'); \n"
+            "if(1 - 1) print('C'); \n"
+            "if(2 > 1) { print('D'); } else { print('E'); } \n"
+            "while(0) print('F'); \n"
+            "for(i = 5; 0; ++i) print('G'); \n"
+            "do print('H'); while(0); \n"
+            "print(i); \n";
+        REQUIRE(ExecuteWithOptimization(code, true) == "B\nD\nH\n5\n");
+        RequireSameWithoutOptimization(code);
+    }
+    SECTION("Unreachable statements")
+    {
+        const char* code = "function f() { print('A'); return 1; print('B'); } \n"
+            "function g() { { print('C'); { throw 'D'; } print('E'); } print('F'); } \n"
+            "for(i = 0; i < 3; ++i) { if(i == 1) { print(i); continue; print('G'); } if(i == 2) { break; print('H'); } } \n"
+            "switch(2) { case 1: print('I'); case 2: print('J'); break; print('K'); case 3: print('L'); } \n"
+            "print(f()); \n"
+            "try { g(); } catch(ex) { print(ex); } \n";
+        REQUIRE(ExecuteWithOptimization(code, true) == "1\nJ\nA\n1\nC\nD\n");
+        RequireSameWithoutOptimization(code);
+    }
+    SECTION("Errors in constant expressions are reported during execution")
+    {
+        const char* code = "print('A'); if(0) print('a' - 1); \n"
+            "x = 'b' * 2; \n";
+        REQUIRE_THROWS_AS( Environment{}.Execute(code), ExecutionError );
+        RequireSameWithoutOptimization(code);
+        RequireSameWithoutOptimization("print('A'); a = 1; (1 ? a : 2) = 3;");
+        RequireSameWithoutOptimization("print('A'); (1, a) = 3;");
+        RequireSameWithoutOptimization("print('A'); ++(1 + 2);");
+        RequireSameWithoutOptimization("print('A'); 1 = 2;");
+        RequireSameWithoutOptimization("print('A'); print('abc'[5]);");
+        RequireSameWithoutOptimization("print('A'); print((1 + 1) / 0, -(1 / 0));");
+    }
+    SECTION("Calls through operators with constant operand")
+    {
+        const char* code = "obj = {v: 3, f: function() { return this ? this.v : 'none'; }}; \n"
+            "print((1 ? obj.f : 0)(), (0, obj.f)(), (1 && obj.f)()); \n";
+        RequireSameWithoutOptimization(code);
+    }
+    SECTION("Loop invariant expressions")
+    {
+        const char* code = "n = 4; arr = [1, 2, 3]; cfg = {inner: {limit: 3}}; s = 'ab'; sum = 0; \n"
+            "for(i = 0; i < n * 2 && i < cfg.inner.limit + arr.count; ++i) { sum += arr.count * (n + 1) + s.count; } \n"
+            "print(i, sum); \n"
+            "j = 0; while(j < 3) { k = 0; do { sum += n * n + j; ++k; } while(k < arr.count); ++j; } \n"
+            "print(sum); \n"
+            "for(item : arr) sum += item * (n - 1); \n"
+            "print(sum); \n";
+        REQUIRE(ExecuteWithOptimization(code, true) == "6\n102\n255\n273\n");
+        RequireSameWithoutOptimization(code);
+    }
+    SECTION("Loop modifying what an expression reads")
+    {
+        const char* code = "n = 1; arr = [1]; obj = {v: 1}; s = 'a'; sum = 0; \n"
+            "for(i = 0; i < 3; ++i) { sum += n * 10; n = n + 1; } print(sum); \n"
+            "for(i = 0; i < 3; ++i) { sum += arr[0] * 2; arr[0] = arr[0] + 1; } print(sum); \n"
+            "other = obj; for(i = 0; i < 3; ++i) { sum += obj.v * 2; other.v += 1; } print(sum); \n"
+            "for(i = 0; i < 3; ++i) { print(s + s); s[0] = 'b'; } \n"
+            "for(x : [1, 2, 3]) sum += x * 100; print(sum); \n"
+            "for(i = 0; i < 2; ++i) { try { throw i; } catch(ex) { sum += ex * 1000; } } print(sum); \n"
+            "function f() { for(i = 0; i < 3; ++i) { print(v * 2); obj2.v += 1; } } \n"
+            "obj2 = {v: 1, f: f}; obj2.f(); \n";
+        REQUIRE(ExecuteWithOptimization(code, true) == "60\n72\n84\naa\nbb\nbb\n684\n1684\n2\n4\n6\n");
+        RequireSameWithoutOptimization(code);
+    }
+    SECTION("Errors in loop invariant expressions")
+    {
+        RequireSameWithoutOptimization("s = 'a'; for(i = 0; i < 0; ++i) x = s - 1; print('A');");
+        RequireSameWithoutOptimization("s = 'a'; for(i = 0; i < 3; ++i) { print(i); if(i == 1) x = s - 1; }");
+        RequireSameWithoutOptimization("s = 'a'; i = 0; while(i < 3) { ++i; try { x = s * 2; } catch(ex) { print(i); } }");
+    }
+    SECTION("Common subexpressions")
+    {
+        const char* code = "a = 3; b = 4; arr = [0, 0, 0, 0, 0, 0]; \n"
+            "x = (a * b + 1) * (a * b + 1) - (a * b + 1); \n"
+            "arr[a - 1] = (a - 1) * 10; \n"
+            "a = a + a * a + a * a; \n"
+            "y = b > 3 ? b * b : 0; y += b * b; \n"
+            "print(x, arr[2], a, y); \n";
+        REQUIRE(ExecuteWithOptimization(code, true) == "156\n20\n21\n32\n");
+        RequireSameWithoutOptimization(code);
+    }
+    SECTION("Counting loops")
+    {
+        // Digits of every iteration are appended to s.
+        const char* code = "n = 4; s = 0; \n"
+            "for(i = 0; i < n; ++i) s = s * 10 + i; \n"
+            "for(i = n; i >= 0; i -= 2) s = s * 10 + i; \n"
+            "for(i = 1; i <= 3; i++) { if(i == 2) continue; s = s * 10 + i; } \n"
+            "for(i = 9; i > 0; --i) { if(i == 6) break; s = s * 10 + i; } \n"
+            "function f(n) { r = 0; for(i = 0; i < n; ++i) r += g(i); return r; } \n"
+            "function g(x) { i = 100; return x; } \n"
+            "print(s, i, f(5), i); \n";
+        REQUIRE(ExecuteWithOptimization(code, true) == "1.23442e+12\n6\n10\n100\n");
+        RequireSameWithoutOptimization(code);
+    }
+    SECTION("Counting loops modified in a non-canonical way")
+    {
+        const char* code = "s = 0; \n"
+            // Counter modified by the body, by a called function, through 'this'.
+            "for(i = 0; i < 9; ++i) { s = s * 10 + i; i += 2; } \n"
+            "function skip() { i += 3; } \n"
+            "for(i = 0; i < 9; ++i) { s = s * 10 + i; skip(); } \n"
+            "obj = { i: 0, run: function() { for(i = 0; i < 5; ++i) { s = s * 10 + i; obj.i = 3; } } }; \n"
+            "obj.run(); \n"
+            "print(s); s = 0; \n"
+            // Bound modified by the body, counter and bound that are not numbers.
+            "n = 3; for(i = 0; i < n; ++i) { s = s * 10 + i; if(i == 1) n = 5; } \n"
+            "t = ''; for(i = 'a'; i < 'aaa'; i += 'a') t += i; \n"
+            "print(s, t); \n"
+            "n = 2; for(i = 0; i < n; ++i) n = 'x'; \n";
+        REQUIRE(ExecuteWithOptimization(code, true) == "3.69048e+08\n1234\naaa\nError: (11,23): Incompatible types.");
+        RequireSameWithoutOptimization(code);
+    }
+    SECTION("Return value of script")
+    {
+        Environment env;
+        const Value val = env.Execute("if(1) { return 2 * 3; print('A'); } return 0;");
+        REQUIRE(val.GetType() == ValueType::Number);
+        REQUIRE(val.GetNumber() == 6.0);
+        REQUIRE(env.GetOutput().empty());
+    }
+}
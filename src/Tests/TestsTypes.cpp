@@ -134,4 +134,41 @@ TEST_CASE("Types")
         const char* code = "v2=Type(123); \n";
         REQUIRE_THROWS_AS( env.Execute(code), ExecutionError );
     }
+    SECTION("StringBuilder construction")
+    {
+        const char* code = "sb1=StringBuilder(); sb2=StringBuilder('AB'); sb3=StringBuilder(sb2); sb3.append('C'); \n"
+            "print(typeOf(sb1), sb1.count, sb2, sb3, sb2==sb3, String(sb3)); \n";
+        env.Execute(code);
+        REQUIRE(env.GetOutput() == "StringBuilder\n0\nAB\nABC\n0\nABC\n");
+    }
+    SECTION("StringBuilder construction invalid")
+    {
+        const char* code = "sb=StringBuilder(123); \n";
+        REQUIRE_THROWS_AS( env.Execute(code), ExecutionError );
+    }
+    SECTION("StringBuilder append count toString")
+    {
+        const char* code = "sb=StringBuilder(); \n"
+            "for(i=0; i<3; ++i) sb.append('A', 'B'); \n"
+            "other=sb; other.append(StringBuilder('-')); \n"
+            "s=sb.toString(); s[0]='X'; \n"
+            "print(sb.count, sb.toString(), s, typeOf(s)); \n";
+        env.Execute(code);
+        REQUIRE(env.GetOutput() == "7\nABABAB-\nXBABAB-\nString\n");
+    }
+    SECTION("StringBuilder long output")
+    {
+        const char* code = "sb=StringBuilder(); \n"
+            "for(i=0; i<100000; ++i) sb.append('0123456789'); \n"
+            "print(sb.count); \n";
+        env.Execute(code);
+        REQUIRE(env.GetOutput() == "1e+06\n");
+    }
+    SECTION("StringBuilder invalid append")
+    {
+        const char* code = "sb=StringBuilder(); sb.append(123); \n";
+        REQUIRE_THROWS_AS( env.Execute(code), ExecutionError );
+        code = "sb=StringBuilder(); sb.FOO; \n";
+        REQUIRE_THROWS_AS( env.Execute(code), ExecutionError );
+    }
 }